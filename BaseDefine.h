@@ -1,9 +1,9 @@
 #ifndef MANIPULATE_BITMAP_BASE_DEFINE_H_
 #define MANIPULATE_BITMAP_BASE_DEFINE_H_
 
-#ifdef _DEBUG
+#if defined(_DEBUG) && defined(_MSC_VER)
 #define MANIPULATE_BITMAP_DEBUG
-#endif // _DEBUG
+#endif // _DEBUG && _MSC_VER
 
 #ifdef MANIPULATE_BITMAP_DEBUG
 #define _CRTDBG_MAP_ALLOC
@@ -14,5 +14,6 @@
 #endif // MANIPULATE_BITMAP_DEBUG
 
 #define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 
 #endif // MANIPULATE_BITMAP_BASE_DEFINE_H_
\ No newline at end of file
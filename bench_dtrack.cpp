@@ -0,0 +1,1083 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include "catch.hpp"
+#include "dtrack.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#elif defined(__linux__)
+#include <fstream>
+#include <unistd.h>
+#endif
+
+// Resident set size of the process, 0 where it is not known.
+size_t ResidentBytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#elif defined(__linux__)
+  size_t pages = 0;
+  size_t resident = 0;
+  std::ifstream statm("/proc/self/statm");
+  statm >> pages >> resident;
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+TEST_CASE("Benchmark position allocation and free", "[!benchmark]") {
+  const size_t churn = 1000;
+  const size_t live_counts[] = { 10000, 1000000, 10000000 };
+  for (size_t live : live_counts) {
+    dtrack::detail::PositionAllocator allocator;
+    std::vector<std::tuple<size_t, uintptr_t>> positions;
+    positions.reserve(live);
+    for (size_t i = 0; i < live; ++i) {
+      positions.push_back(allocator.Allocate());
+    }
+    std::mt19937_64 random(live);
+    std::shuffle(positions.begin(), positions.end(), random);
+    BENCHMARK(std::to_string(churn) + " free/allocate pairs with " + std::to_string(live) + " live positions") {
+      for (size_t i = 0; i < churn; ++i) {
+        allocator.Free(positions[i]);
+      }
+      for (size_t i = 0; i < churn; ++i) {
+        positions[i] = allocator.Allocate();
+      }
+      return positions[churn - 1];
+    };
+  }
+}
+
+TEST_CASE("Benchmark invalidation of a dependency cone", "[!benchmark]") {
+  const size_t cone_size = 100000;
+  const size_t fan_out = 8;
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 0);
+  std::vector<std::unique_ptr<dtrack::DTracker<int, int>>> trackers;
+  trackers.reserve(cone_size);
+  for (size_t i = 0; i < cone_size; ++i) {
+    trackers.emplace_back(new dtrack::DTracker<int, int>(global, [] (const int& input) { return input + 1; }));
+    if (i < fan_out) {
+      trackers.back()->Watch<0>(source);
+    } else {
+      trackers.back()->Watch<0>(*trackers[i / fan_out - 1]);
+    }
+  }
+  // Every run needs a fully validated cone, which Catch benchmarks cannot set up per iteration.
+  const int runs = 100;
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration::zero();
+  for (int run = 1; run <= runs; ++run) {
+    for (size_t i = 0; i < trackers.size(); ++i) {
+      trackers[i]->Value();
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    source.SetValue(run);
+    elapsed += std::chrono::steady_clock::now() - start;
+  }
+  WARN(
+    "invalidating " << cone_size << " trackers took "
+    << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / runs << " us on average"
+  );
+}
+
+TEST_CASE("Benchmark parallel apply on a wide graph", "[!benchmark]") {
+  const size_t width = 2000;
+  const size_t depth = 4;
+  dtrack::DTrack global;
+  dtrack::DValue<double> source(global, 0.0);
+  std::function<double(const double&, const double&)> expensive = [] (const double& lhs, const double& rhs) {
+    double result = lhs + rhs;
+    for (int i = 0; i < 2000; ++i) {
+      result = std::sqrt(result * result + 1.0);
+    }
+    return result;
+  };
+  std::vector<std::unique_ptr<dtrack::DTracker<double, double, double>>> trackers;
+  for (size_t level = 0; level < depth; ++level) {
+    for (size_t i = 0; i < width; ++i) {
+      trackers.emplace_back(new dtrack::DTracker<double, double, double>(global, expensive));
+      if (level == 0) {
+        trackers.back()->Watch<0>(source).Watch<1>(source);
+      } else {
+        size_t previous = (level - 1) * width;
+        trackers.back()->Watch<0>(*trackers[previous + i]).Watch<1>(*trackers[previous + (i + 1) % width]);
+      }
+    }
+  }
+  const size_t worker_counts[] = { 1, 2, 4, 8, 16 };
+  for (size_t workers : worker_counts) {
+    global.SetWorkerCount(workers);
+    BENCHMARK("apply " + std::to_string(width) + "x" + std::to_string(depth) + " with " + std::to_string(workers) + " workers") {
+      source.SetValue(source.Value() + 1.0);
+      global.Apply();
+    };
+  }
+}
+
+TEST_CASE("Benchmark scanning for invalid positions", "[!benchmark]") {
+  const size_t slots = 10000000;
+  const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+  std::vector<uintptr_t> words((slots + bits - 1) / bits, 0);
+  std::mt19937_64 random(slots);
+  std::uniform_int_distribution<size_t> slot(0, slots - 1);
+  for (size_t i = 0; i < slots / 1000; ++i) {
+    size_t dirty = slot(random);
+    words[dirty / bits] = words[dirty / bits] | (static_cast<uintptr_t>(1) << (dirty % bits));
+  }
+  BENCHMARK("enumerate 0.1% invalid of " + std::to_string(slots) + " slots") {
+    size_t sum = 0;
+    dtrack::detail::ForEachNonZeroWord(
+      words.data(),
+      words.size(),
+      [&sum] (size_t word, uintptr_t invalid) {
+        while (invalid) {
+          sum += word + bitops::CountTrailingZeros(invalid);
+          invalid = invalid & (invalid - 1);
+        }
+      }
+    );
+    return sum;
+  };
+}
+
+TEST_CASE("Benchmark bit scan against the compiler intrinsic", "[!benchmark]") {
+  std::vector<uint64_t> words(1 << 16);
+  std::mt19937_64 random(words.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    words[i] = random() | (static_cast<uint64_t>(1) << 63);
+  }
+  BENCHMARK("bitops::CountTrailingZeros over " + std::to_string(words.size()) + " words") {
+    int sum = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+      sum += bitops::CountTrailingZeros(words[i]);
+    }
+    return sum;
+  };
+  BENCHMARK("intrinsic over " + std::to_string(words.size()) + " words") {
+    int sum = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+#if defined(_MSC_VER)
+      unsigned long index;
+      _BitScanForward64(&index, words[i]);
+      sum += static_cast<int>(index);
+#else
+      sum += __builtin_ctzll(words[i]);
+#endif
+    }
+    return sum;
+  };
+}
+
+// Run under `perf stat -e cache-misses` to compare the registry layouts.
+TEST_CASE("Benchmark invalidating and applying a 1M tracker graph", "[!benchmark]") {
+  const size_t tracker_count = 1000000;
+  const size_t fan_out = 4;
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 0);
+  std::vector<std::unique_ptr<dtrack::DTracker<int, int>>> trackers;
+  trackers.reserve(tracker_count);
+  for (size_t i = 0; i < tracker_count; ++i) {
+    trackers.emplace_back(new dtrack::DTracker<int, int>(global, [] (const int& input) { return input + 1; }));
+    if (i < fan_out) {
+      trackers.back()->Watch<0>(source);
+    } else {
+      trackers.back()->Watch<0>(*trackers[i / fan_out - 1]);
+    }
+  }
+  global.Apply();
+  BENCHMARK("invalidate and apply " + std::to_string(tracker_count) + " trackers") {
+    source.SetValue(source.Value() + 1);
+    global.Apply();
+  };
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  BENCHMARK("push a write through " + std::to_string(tracker_count) + " trackers") {
+    source.SetValue(source.Value() + 1);
+  };
+}
+
+TEST_CASE("Benchmark tracking 5M values", "[!benchmark]") {
+  const size_t value_count = 5000000;
+  const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+  dtrack::DTrack global;
+  std::vector<dtrack::DValue<int>> values;
+  values.reserve(value_count);
+  for (size_t i = 0; i < value_count; ++i) {
+    values.emplace_back(global, static_cast<int>(i));
+  }
+  WARN(
+    "a value takes " << sizeof(dtrack::detail::Trackable<int>)
+    << " bytes and does not allocate while it is watched by trackers in up to 4 words"
+  );
+  // A fan out of 1 to 4 trackers spread over different words of the bitmap.
+  BENCHMARK("track and stop tracking " + std::to_string(value_count) + " values") {
+    for (size_t i = 0; i < value_count; ++i) {
+      for (size_t watcher = 0; watcher <= i % 4; ++watcher) {
+        values[i].tracked_value_->Track(std::make_tuple(i / bits + watcher * 1000, static_cast<uintptr_t>(1) << (i % bits)));
+      }
+    }
+    for (size_t i = 0; i < value_count; ++i) {
+      for (size_t watcher = 0; watcher <= i % 4; ++watcher) {
+        values[i].tracked_value_->StopTrack(std::make_tuple(i / bits + watcher * 1000, static_cast<uintptr_t>(1) << (i % bits)));
+      }
+    }
+    return values.size();
+  };
+}
+
+TEST_CASE("Benchmark writing a large value", "[!benchmark]") {
+  const size_t payload_size = 1 << 20;
+  dtrack::DTrack global;
+  dtrack::DValue<std::vector<float>> source(global, std::vector<float>(payload_size, 0.0f));
+  dtrack::DTracker<float, std::vector<float>> last(global, [] (const std::vector<float>& input) { return input.back(); });
+  last.Watch<0>(source);
+  float step = 0.0f;
+  BENCHMARK("copy in a 4MB vector") {
+    std::vector<float> payload(payload_size, ++step);
+    source.SetValue(payload);
+    return last.Value();
+  };
+  BENCHMARK("move in a 4MB vector") {
+    std::vector<float> payload(payload_size, ++step);
+    source.SetValue(std::move(payload));
+    return last.Value();
+  };
+  BENCHMARK("modify one element of a 4MB vector in place") {
+    source.Modify([&step] (std::vector<float>& value) {
+      value.back() = ++step;
+      return true;
+    });
+    return last.Value();
+  };
+}
+
+TEST_CASE("Benchmark change policies on a large value", "[!benchmark]") {
+  const size_t payload_size = 1 << 20;
+  dtrack::DTrack global;
+  dtrack::DValue<std::vector<float>> compared(global, std::vector<float>(payload_size, 0.0f));
+  dtrack::DValue<std::vector<float>, dtrack::AlwaysInvalidate> always(global, std::vector<float>(payload_size, 0.0f));
+  std::vector<float> payload(payload_size, 0.0f);
+  float step = 0.0f;
+  BENCHMARK("operator!= on a 4MB vector") {
+    payload.back() = ++step;
+    compared.SetValue(payload);
+  };
+  BENCHMARK("always invalidate a 4MB vector") {
+    payload.back() = ++step;
+    always.SetValue(payload);
+  };
+}
+
+template<typename Tracker>
+double RecomputeLatency(Tracker& tracker, int calls) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int changed = 0;
+  for (int i = 0; i < calls; ++i) {
+    changed += tracker.Evaluate();
+  }
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(changed == 1);
+  return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+TEST_CASE("Benchmark recompute latency over 10M calls", "[!benchmark]") {
+  const int calls = 10000000;
+  std::shared_ptr<dtrack::detail::GlobalBlock> global_block = std::make_shared<dtrack::detail::GlobalBlock>();
+  dtrack::detail::NodeRef<dtrack::detail::Trackable<int>> source =
+    dtrack::detail::MakeNode<dtrack::detail::Trackable<int>>(global_block->Nodes(), global_block.get(), 1);
+  auto increment = [] (const int& input) { return input + 1; };
+  dtrack::detail::CalculatorTracker<decltype(increment), int, int> inline_calculator(global_block.get(), increment);
+  dtrack::detail::CalculatorTracker<std::function<int(const int&)>, int, int> erased_calculator(global_block.get(), increment);
+  inline_calculator.Watch<0>(source);
+  erased_calculator.Watch<0>(source);
+  double inline_latency = RecomputeLatency(inline_calculator, calls);
+  double erased_latency = RecomputeLatency(erased_calculator, calls);
+  WARN(
+    "a recompute took " << inline_latency << " ns with the lambda stored inline and "
+    << erased_latency << " ns through std::function"
+  );
+}
+
+TEST_CASE("Benchmark building and tearing down a 1M node graph", "[!benchmark]") {
+  const size_t tracker_count = 1000000;
+  const size_t fan_out = 4;
+  const int runs = 3;
+  std::chrono::steady_clock::duration construction = std::chrono::steady_clock::duration::zero();
+  std::chrono::steady_clock::duration teardown = std::chrono::steady_clock::duration::zero();
+  size_t resident = 0;
+  for (int run = 0; run < runs; ++run) {
+    size_t resident_before = ResidentBytes();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+      dtrack::DTrack global;
+      dtrack::DValue<int> source(global, 0);
+      std::vector<dtrack::DTracker<int, int>> trackers;
+      trackers.reserve(tracker_count);
+      for (size_t i = 0; i < tracker_count; ++i) {
+        trackers.emplace_back(global, [] (const int& input) { return input + 1; });
+        if (i < fan_out) {
+          trackers.back().Watch<0>(source);
+        } else {
+          trackers.back().Watch<0>(trackers[i / fan_out - 1]);
+        }
+      }
+      std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+      construction += built - start;
+      resident = std::max(resident, ResidentBytes() - resident_before);
+      start = built;
+    }
+    teardown += std::chrono::steady_clock::now() - start;
+  }
+  WARN(
+    "building " << tracker_count << " trackers took "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(construction).count() / runs << " ms, tearing them down "
+    << std::chrono::duration_cast<std::chrono::milliseconds>(teardown).count() / runs << " ms, the graph grew the resident set by "
+    << resident / tracker_count << " bytes per tracker"
+  );
+}
+
+TEST_CASE("Benchmark building graphs on several threads", "[!benchmark]") {
+  const size_t trackers_per_thread = 250000;
+  const size_t thread_counts[] = { 1, 2, 4, 8 };
+  for (size_t thread_count : thread_counts) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> builders;
+    for (size_t i = 0; i < thread_count; ++i) {
+      builders.emplace_back([trackers_per_thread] {
+        dtrack::DTrack global;
+        dtrack::DValue<int> source(global, 0);
+        std::vector<dtrack::DTracker<int, int>> trackers;
+        trackers.reserve(trackers_per_thread);
+        for (size_t i = 0; i < trackers_per_thread; ++i) {
+          trackers.emplace_back(global, [] (const int& input) { return input + 1; });
+          if (i == 0) {
+            trackers.back().Watch<0>(source);
+          } else {
+            trackers.back().Watch<0>(trackers[i - 1]);
+          }
+        }
+      });
+    }
+    for (std::thread& builder : builders) {
+      builder.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    WARN(
+      thread_count << " threads built and tore down "
+      << static_cast<size_t>(thread_count * trackers_per_thread / elapsed.count()) << " trackers per second"
+    );
+  }
+}
+
+TEST_CASE("Benchmark applying edits cut off below a clamp", "[!benchmark]") {
+  const size_t tracker_count = 1000000;
+  const size_t fan_out = 4;
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 100);
+  dtrack::DTracker<int, int> clamp(global, [] (const int& input) { return std::min(input, 10); });
+  clamp.Watch<0>(source);
+  std::vector<dtrack::DTracker<int, int>> trackers;
+  trackers.reserve(tracker_count);
+  for (size_t i = 0; i < tracker_count; ++i) {
+    trackers.emplace_back(global, [] (const int& input) { return input + 1; });
+    if (i < fan_out) {
+      trackers.back().Watch<0>(clamp);
+    } else {
+      trackers.back().Watch<0>(trackers[i / fan_out - 1]);
+    }
+  }
+  global.Apply();
+  dtrack::UpdateStatistics before = global.Statistics();
+  int edits = 0;
+  BENCHMARK("apply an edit which the clamp absorbs above " + std::to_string(tracker_count) + " trackers") {
+    source.SetValue(source.Value() + 1);
+    global.Apply();
+    return ++edits;
+  };
+  WARN(
+    edits << " edits recalculated " << global.Statistics().recomputations - before.recomputations
+    << " trackers and cut off " << global.Statistics().cutoffs - before.cutoffs
+  );
+}
+
+TEST_CASE("Benchmark writing 10K values with and without a transaction", "[!benchmark]") {
+  const size_t value_count = 10000;
+  dtrack::DTrack global;
+  std::vector<dtrack::DValue<int>> values;
+  std::vector<dtrack::DTracker<int, int, int>> sums;
+  values.reserve(value_count);
+  sums.reserve(value_count);
+  for (size_t i = 0; i < value_count; ++i) {
+    values.emplace_back(global, 0);
+  }
+  // Neighbouring values share watchers, so separate writes invalidate most trackers twice.
+  for (size_t i = 0; i < value_count; ++i) {
+    sums.emplace_back(global, [] (const int& lhs, const int& rhs) { return lhs + rhs; });
+    sums.back().Watch<0>(values[i]).Watch<1>(values[(i + 1) % value_count]);
+  }
+  global.Apply();
+  int round = 0;
+  BENCHMARK("write " + std::to_string(value_count) + " values one by one and apply") {
+    ++round;
+    for (size_t i = 0; i < value_count; ++i) {
+      values[i].SetValue(round);
+    }
+    global.Apply();
+  };
+  BENCHMARK("write " + std::to_string(value_count) + " values in a transaction and apply") {
+    ++round;
+    {
+      dtrack::DTrack::Transaction transaction(global);
+      for (size_t i = 0; i < value_count; ++i) {
+        values[i].SetValue(round);
+      }
+    }
+    global.Apply();
+  };
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  BENCHMARK("push " + std::to_string(value_count) + " writes one by one") {
+    ++round;
+    for (size_t i = 0; i < value_count; ++i) {
+      values[i].SetValue(round);
+    }
+  };
+  BENCHMARK("push " + std::to_string(value_count) + " writes in a transaction") {
+    ++round;
+    dtrack::DTrack::Transaction transaction(global);
+    for (size_t i = 0; i < value_count; ++i) {
+      values[i].SetValue(round);
+    }
+  };
+}
+
+TEST_CASE("Benchmark writing a concurrent graph from several threads", "[!benchmark]") {
+  const size_t values_per_thread = 1024;
+  const int rounds = 200;
+  const size_t thread_counts[] = { 1, 2, 4, 8 };
+  {
+    dtrack::DTrack global;
+    std::vector<dtrack::DValue<int>> values;
+    std::vector<dtrack::DTracker<int, int>> trackers;
+    for (size_t i = 0; i < values_per_thread; ++i) {
+      values.emplace_back(global, 0);
+      trackers.emplace_back(global, [] (const int& input) { return input + 1; });
+      trackers.back().Watch<0>(values.back());
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int round = 1; round <= rounds; ++round) {
+      for (size_t i = 0; i < values_per_thread; ++i) {
+        values[i].SetValue(round);
+      }
+      global.Apply();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    WARN("a single threaded graph took " << static_cast<size_t>(values_per_thread * rounds / elapsed.count()) << " writes per second");
+  }
+  for (size_t thread_count : thread_counts) {
+    dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+    std::vector<dtrack::DValue<int>> values;
+    std::vector<dtrack::DTracker<int, int>> trackers;
+    for (size_t i = 0; i < thread_count * values_per_thread; ++i) {
+      values.emplace_back(global, 0);
+      trackers.emplace_back(global, [] (const int& input) { return input + 1; });
+      trackers.back().Watch<0>(values.back());
+    }
+    std::atomic<size_t> running(thread_count);
+    size_t applies = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (size_t thread = 0; thread < thread_count; ++thread) {
+      writers.emplace_back([&values, &running, thread, values_per_thread, rounds] {
+        for (int round = 1; round <= rounds; ++round) {
+          for (size_t i = 0; i < values_per_thread; ++i) {
+            values[thread * values_per_thread + i].SetValue(round);
+          }
+        }
+        --running;
+      });
+    }
+    while (running > 0) {
+      global.Apply();
+      ++applies;
+    }
+    for (std::thread& writer : writers) {
+      writer.join();
+    }
+    global.Apply();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    WARN(
+      thread_count << " writer threads took "
+      << static_cast<size_t>(thread_count * values_per_thread * rounds / elapsed.count())
+      << " writes per second while the reader applied " << applies << " times"
+    );
+  }
+}
+
+TEST_CASE("Benchmark snapshot reads under a 10kHz write load", "[!benchmark]") {
+  const size_t tracker_count = 1000;
+  const size_t reader_counts[] = { 1, 2, 4 };
+  const std::chrono::milliseconds duration(500);
+  const std::chrono::microseconds write_period(100);
+  for (size_t reader_count : reader_counts) {
+    for (int writing = 0; writing < 2; ++writing) {
+      dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+      global.EnableSnapshots();
+      std::vector<dtrack::DValue<int>> values;
+      std::vector<dtrack::DTracker<int, int>> trackers;
+      for (size_t i = 0; i < tracker_count; ++i) {
+        values.emplace_back(global, 0);
+        trackers.emplace_back(global, [] (const int& input) { return input + 1; });
+        trackers.back().Watch<0>(values.back());
+      }
+      global.Apply();
+      std::atomic<bool> running(true);
+      std::atomic<size_t> reads(0);
+      std::vector<std::thread> readers;
+      for (size_t i = 0; i < reader_count; ++i) {
+        readers.emplace_back([&] {
+          size_t read = 0;
+          int sum = 0;
+          while (running) {
+            dtrack::DTrack::Snapshot snapshot(global);
+            for (size_t j = 0; j < tracker_count; ++j) {
+              sum += snapshot.Read(trackers[j]);
+            }
+            read += tracker_count;
+          }
+          reads += read + (sum == 42 ? 1 : 0);
+        });
+      }
+      // The writer edits a tenth of the values and applies every 100us.
+      size_t applies = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      std::chrono::steady_clock::time_point next_write = start;
+      while (std::chrono::steady_clock::now() - start < duration) {
+        if (writing) {
+          for (size_t i = applies % 10; i < tracker_count; i += 10) {
+            values[i].SetValue(static_cast<int>(applies));
+          }
+          global.Apply();
+          ++applies;
+          next_write += write_period;
+        } else {
+          next_write += duration;
+        }
+        std::this_thread::sleep_until(next_write);
+      }
+      running = false;
+      for (std::thread& reader : readers) {
+        reader.join();
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      WARN(
+        reader_count << " readers took " << static_cast<size_t>(reads / elapsed.count()) << " snapshot reads per second "
+        << (writing ? "while " + std::to_string(static_cast<size_t>(applies / elapsed.count())) + " applies per second published" : std::string("without writes"))
+      );
+    }
+  }
+}
+
+TEST_CASE("Benchmark summing a 1M element vector through its delta", "[!benchmark]") {
+  const size_t item_count = 1000000;
+  const size_t writes = 10;
+  const size_t chunk = dtrack::VectorDelta<int>::kChunkSize;
+  dtrack::DTrack global;
+  dtrack::DVector<int> full_items(global, std::vector<int>(item_count, 1));
+  dtrack::DTracker<long long, std::vector<int>> full_sum(global, [] (const std::vector<int>& input) {
+    long long sum = 0;
+    for (int item : input) {
+      sum += item;
+    }
+    return sum;
+  });
+  full_sum.Watch<0>(full_items);
+  // Sums per chunk, only the dirty chunks are summed again unless the size changed.
+  struct ChunkSum {
+    long long operator()(const dtrack::VectorDelta<int>& delta) {
+      const std::vector<int>& input = delta.Items();
+      bool resized = false;
+      bool incremental = delta.ForEachChangeSince(revision, [&resized] (const dtrack::VectorChange& change) {
+        resized = resized || change.kind != dtrack::VectorChange::Update;
+      });
+      if (!incremental || resized) {
+        sums.assign((input.size() + chunk - 1) / chunk, 0);
+        for (size_t i = 0; i < sums.size(); ++i) {
+          Resum(input, i);
+        }
+      } else {
+        delta.ForEachDirtyChunk([this, &input] (size_t dirty) { Resum(input, dirty); });
+      }
+      revision = delta.Revision();
+      long long sum = 0;
+      for (long long chunk_sum : sums) {
+        sum += chunk_sum;
+      }
+      return sum;
+    }
+
+    void Resum(const std::vector<int>& input, size_t index) {
+      sums[index] = 0;
+      for (size_t i = index * chunk; i < std::min(input.size(), (index + 1) * chunk); ++i) {
+        sums[index] += input[i];
+      }
+    }
+
+    size_t chunk;
+    uint64_t revision;
+    std::vector<long long> sums;
+  };
+  dtrack::DVector<int> delta_items(global, std::vector<int>(item_count, 1));
+  dtrack::DTracker<long long, dtrack::VectorDelta<int>> delta_sum(global, ChunkSum{chunk, 0, {}});
+  delta_sum.Watch<0>(delta_items);
+  global.Apply();
+  std::mt19937 random(7);
+  std::uniform_int_distribution<size_t> position(0, item_count - 1);
+  int round = 0;
+  BENCHMARK("write " + std::to_string(writes) + " of " + std::to_string(item_count) + " elements and sum them all") {
+    ++round;
+    for (size_t i = 0; i < writes; ++i) {
+      full_items.Set(position(random), round);
+    }
+    global.Apply();
+    return full_sum.Value();
+  };
+  BENCHMARK("write " + std::to_string(writes) + " of " + std::to_string(item_count) + " elements and sum the dirty chunks") {
+    ++round;
+    for (size_t i = 0; i < writes; ++i) {
+      delta_items.Set(position(random), round);
+    }
+    global.Apply();
+    return delta_sum.Value();
+  };
+  long long expected = 0;
+  for (int item : delta_items.ValueRef()) {
+    expected += item;
+  }
+  CHECK(delta_sum.Value() == expected);
+}
+
+TEST_CASE("Benchmark incremental trackers against full recalculation", "[!benchmark]") {
+  const size_t item_count = 1000000;
+  const size_t writes = 10;
+  std::mt19937 random(11);
+  std::uniform_int_distribution<size_t> position(0, item_count - 1);
+  std::uniform_int_distribution<int> value(0, 1000000);
+  std::vector<int> initial(item_count);
+  for (int& item : initial) {
+    item = value(random);
+  }
+  dtrack::DTrack global;
+  int round = 0;
+  // Each pair watches a vector of its own, so that Apply only recalculates the pair measured.
+  auto measure = [&] (const std::string& name, dtrack::DVector<int>& items, const std::function<long long()>& read) {
+    BENCHMARK("write " + std::to_string(writes) + " of " + std::to_string(item_count) + " elements and " + name) {
+      ++round;
+      for (size_t i = 0; i < writes; ++i) {
+        items.Set(position(random), value(random));
+      }
+      global.Apply();
+      return read();
+    };
+  };
+
+  dtrack::DVector<int> map_items(global, initial);
+  dtrack::DTracker<std::vector<long long>, std::vector<int>> full_map(global, [] (const std::vector<int>& input) {
+    std::vector<long long> output(input.size());
+    std::transform(input.begin(), input.end(), output.begin(), [] (int item) { return static_cast<long long>(item) * item; });
+    return output;
+  });
+  full_map.Watch<0>(map_items);
+  measure("map them all", map_items, [&full_map] () { return static_cast<long long>(full_map.Value().size()); });
+  full_map = dtrack::DTracker<std::vector<long long>, std::vector<int>>(global, [] (const std::vector<int>&) { return std::vector<long long>(); });
+  auto map = dtrack::MakeTracker(global, dtrack::MakeIncrementalMap<int>([] (const int& item) { return static_cast<long long>(item) * item; }));
+  map.Watch<0>(map_items);
+  global.Apply();
+  measure("map the written ones", map_items, [&map] () { return static_cast<long long>(map.Value().Items().size()); });
+
+  dtrack::DVector<int> filter_items(global, initial);
+  dtrack::DTracker<std::vector<int>, std::vector<int>> full_filter(global, [] (const std::vector<int>& input) {
+    std::vector<int> output;
+    std::copy_if(input.begin(), input.end(), std::back_inserter(output), [] (int item) { return item % 3 == 0; });
+    return output;
+  });
+  full_filter.Watch<0>(filter_items);
+  measure("filter them all", filter_items, [&full_filter] () { return static_cast<long long>(full_filter.Value().size()); });
+  full_filter = dtrack::DTracker<std::vector<int>, std::vector<int>>(global, [] (const std::vector<int>&) { return std::vector<int>(); });
+  auto filter = dtrack::MakeTracker(global, dtrack::MakeIncrementalFilter<int>([] (const int& item) { return item % 3 == 0; }));
+  filter.Watch<0>(filter_items);
+  global.Apply();
+  measure("filter the written ones", filter_items, [&filter] () { return static_cast<long long>(filter.Value().Items().size()); });
+
+  dtrack::DVector<int> reduce_items(global, initial);
+  // The maximum has no inverse, an update can not simply be taken back out of a running total.
+  dtrack::DTracker<int, std::vector<int>> full_reduce(global, [] (const std::vector<int>& input) {
+    return *std::max_element(input.begin(), input.end());
+  });
+  full_reduce.Watch<0>(reduce_items);
+  measure("take the maximum of them all", reduce_items, [&full_reduce] () { return static_cast<long long>(full_reduce.Value()); });
+  full_reduce = dtrack::DTracker<int, std::vector<int>>(global, [] (const std::vector<int>&) { return 0; });
+  auto reduce = dtrack::MakeTracker(global, dtrack::MakeIncrementalReduce([] (const int& lhs, const int& rhs) { return std::max(lhs, rhs); }, 0));
+  reduce.Watch<0>(reduce_items);
+  global.Apply();
+  measure("take the maximum through a segment tree", reduce_items, [&reduce] () { return static_cast<long long>(reduce.Value()); });
+
+  dtrack::DVector<int> sort_items(global, initial);
+  dtrack::DTracker<std::vector<int>, std::vector<int>> full_sort(global, [] (const std::vector<int>& input) {
+    std::vector<int> output = input;
+    std::sort(output.begin(), output.end());
+    return output;
+  });
+  full_sort.Watch<0>(sort_items);
+  measure("sort them all", sort_items, [&full_sort] () { return static_cast<long long>(full_sort.Value().front()); });
+  full_sort = dtrack::DTracker<std::vector<int>, std::vector<int>>(global, [] (const std::vector<int>&) { return std::vector<int>(); });
+  auto sort = dtrack::MakeTracker(global, dtrack::IncrementalSort<int>());
+  sort.Watch<0>(sort_items);
+  global.Apply();
+  measure("sort the written ones in", sort_items, [&sort] () { return static_cast<long long>(sort.Value().Items().front()); });
+  CHECK(std::is_sorted(sort.Value().Items().begin(), sort.Value().Items().end()));
+}
+
+TEST_CASE("Benchmark per key watchers of a 1M key map", "[!benchmark]") {
+  const int key_count = 1000000;
+  const int watcher_count = 100000;
+  const int writes = 100;
+  std::unordered_map<int, int> initial;
+  initial.reserve(key_count);
+  for (int key = 0; key < key_count; ++key) {
+    initial.emplace(key, key);
+  }
+  std::mt19937 random(5);
+  std::uniform_int_distribution<int> key(0, key_count - 1);
+  dtrack::DTrack global;
+  int round = 0;
+
+  // Every tracker reads its key out of one value holding the whole map.
+  dtrack::DValue<std::unordered_map<int, int>, dtrack::AlwaysInvalidate> whole(global, initial);
+  std::vector<dtrack::DTracker<int, std::unordered_map<int, int>>> lookups;
+  lookups.reserve(watcher_count);
+  for (int i = 0; i < watcher_count; ++i) {
+    int watched = i * (key_count / watcher_count);
+    lookups.emplace_back(global, [watched] (const std::unordered_map<int, int>& items) { return items.at(watched); });
+    lookups.back().Watch<0>(whole);
+  }
+  global.Apply();
+  BENCHMARK("write " + std::to_string(writes) + " keys of a map value watched by " + std::to_string(watcher_count) + " trackers and apply") {
+    ++round;
+    for (int i = 0; i < writes; ++i) {
+      int written = key(random);
+      whole.Modify([written, round] (std::unordered_map<int, int>& items) {
+        items[written] = round;
+        return true;
+      });
+    }
+    global.Apply();
+    return lookups.front().Value();
+  };
+  lookups.clear();
+  whole = dtrack::DValue<std::unordered_map<int, int>, dtrack::AlwaysInvalidate>(global);
+
+  dtrack::DMap<int, int> map(global, initial);
+  std::vector<dtrack::DTracker<int, int>> keys;
+  keys.reserve(watcher_count);
+  for (int i = 0; i < watcher_count; ++i) {
+    keys.emplace_back(global, [] (const int& value) { return value; });
+    keys.back().Watch<0>(map, i * (key_count / watcher_count));
+  }
+  global.Apply();
+  dtrack::UpdateStatistics before = global.Statistics();
+  int first_round = round;
+  BENCHMARK("write " + std::to_string(writes) + " keys of a DMap with " + std::to_string(watcher_count) + " key watchers and apply") {
+    ++round;
+    for (int i = 0; i < writes; ++i) {
+      map.Set(key(random), round);
+    }
+    global.Apply();
+    return keys.front().Value();
+  };
+  WARN(
+    "the DMap watchers recalculated " << (global.Statistics().recomputations - before.recomputations) / (round - first_round)
+    << " times per " << writes << " writes"
+  );
+  // Writes to watched keys only.
+  BENCHMARK("write " + std::to_string(writes) + " watched keys of a DMap and apply") {
+    ++round;
+    for (int i = 0; i < writes; ++i) {
+      map.Set(key(random) / (key_count / watcher_count) * (key_count / watcher_count), round);
+    }
+    global.Apply();
+    return keys.front().Value();
+  };
+  keys.clear();
+
+  // Watching a range copies the keys in it out of the whole map, so these watch a smaller one.
+  const int span_key_count = 100000;
+  const int span_count = 1000;
+  const int span_width = span_key_count / span_count;
+  std::unordered_map<int, int> span_items;
+  for (int key = 0; key < span_key_count; ++key) {
+    span_items.emplace(key, key);
+  }
+  dtrack::DMap<int, int> spanned(global, span_items);
+  std::vector<dtrack::DTracker<size_t, std::map<int, int>>> spans;
+  spans.reserve(span_count);
+  for (int i = 0; i < span_count; ++i) {
+    spans.emplace_back(global, [] (const std::map<int, int>& items) { return items.size(); });
+    spans.back().Watch<0>(spanned, i * span_width, (i + 1) * span_width);
+  }
+  global.Apply();
+  std::uniform_int_distribution<int> span_key(0, span_key_count - 1);
+  BENCHMARK("write " + std::to_string(writes) + " keys of a DMap with " + std::to_string(span_count) + " range watchers and apply") {
+    ++round;
+    for (int i = 0; i < writes; ++i) {
+      spanned.Set(span_key(random), round);
+    }
+    global.Apply();
+    return spans.front().Value();
+  };
+}
+
+TEST_CASE("Benchmark auto trackers dropping conditionally read inputs", "[!benchmark]") {
+  const int tracker_count = 10000;
+  dtrack::DTrack global;
+  int round = 0;
+  // Every tracker picks one of its two inputs, the benchmarks write the ones which are not picked.
+  dtrack::DValue<bool> use_first(global, true);
+  std::vector<dtrack::DValue<int>> first;
+  std::vector<dtrack::DValue<int>> second;
+  for (int i = 0; i < tracker_count; ++i) {
+    first.emplace_back(global, i);
+    second.emplace_back(global, -i);
+  }
+
+  std::vector<dtrack::DTracker<int, bool, int, int>> declared;
+  declared.reserve(tracker_count);
+  for (int i = 0; i < tracker_count; ++i) {
+    declared.emplace_back(global, [] (const bool& use, const int& a, const int& b) { return use ? a : b; });
+    declared.back().Watch<0>(use_first).Watch<1>(first[i]).Watch<2>(second[i]);
+  }
+  global.Apply();
+  dtrack::UpdateStatistics before = global.Statistics();
+  int first_round = round;
+  BENCHMARK("write the unused inputs of " + std::to_string(tracker_count) + " declared trackers and apply") {
+    ++round;
+    for (int i = 0; i < tracker_count; ++i) {
+      second[i].SetValue(round);
+    }
+    global.Apply();
+    return declared.front().Value();
+  };
+  WARN(
+    "the declared trackers recalculated " << (global.Statistics().recomputations - before.recomputations) / (round - first_round)
+    << " times per round"
+  );
+  declared.clear();
+
+  std::vector<dtrack::DAutoTracker<int>> automatic;
+  automatic.reserve(tracker_count);
+  for (int i = 0; i < tracker_count; ++i) {
+    dtrack::DValue<int>* a = &first[i];
+    dtrack::DValue<int>* b = &second[i];
+    automatic.emplace_back(global, [&use_first, a, b] () { return use_first.ValueRef() ? a->ValueRef() : b->ValueRef(); });
+  }
+  global.Apply();
+  before = global.Statistics();
+  first_round = round;
+  BENCHMARK("write the unused inputs of " + std::to_string(tracker_count) + " auto trackers and apply") {
+    ++round;
+    for (int i = 0; i < tracker_count; ++i) {
+      second[i].SetValue(round);
+    }
+    global.Apply();
+    return automatic.front().Value();
+  };
+  WARN(
+    "the auto trackers recalculated " << (global.Statistics().recomputations - before.recomputations) / (round - first_round)
+    << " times per round"
+  );
+  // Switching the condition rewatches every tracker.
+  BENCHMARK("flip the condition of " + std::to_string(tracker_count) + " auto trackers and apply") {
+    use_first.SetValue(!use_first.Value());
+    global.Apply();
+    return automatic.front().Value();
+  };
+}
+
+struct PipelineSpot : dtrack::StaticInput<double> {};
+struct PipelineVolatility : dtrack::StaticInput<double> {};
+
+template<int K>
+struct PipelineStage : dtrack::StaticNode<double, PipelineStage<K - 1>, PipelineVolatility> {
+  static double Calculate(const double& previous, const double& volatility) {
+    return previous * (1 + volatility) - volatility;
+  }
+};
+
+template<>
+struct PipelineStage<0> : dtrack::StaticNode<double, PipelineSpot, PipelineVolatility> {
+  static double Calculate(const double& spot, const double& volatility) {
+    return spot * (1 + volatility);
+  }
+};
+
+template<int... K>
+dtrack::StaticGraph<PipelineSpot, PipelineVolatility, PipelineStage<K>...> MakePipeline(std::integer_sequence<int, K...>) {
+  return dtrack::StaticGraph<PipelineSpot, PipelineVolatility, PipelineStage<K>...>();
+}
+
+TEST_CASE("Benchmark a static pipeline against the same DTracker graph", "[!benchmark]") {
+  const int stage_count = 64;
+  const int writes = 1000;
+  typedef decltype(MakePipeline(std::make_integer_sequence<int, stage_count>{})) Pipeline;
+  Pipeline pipeline;
+  pipeline.Set<PipelineVolatility>(0.001);
+  double spot = 0;
+  BENCHMARK("write and read a " + std::to_string(stage_count) + " stage static pipeline " + std::to_string(writes) + " times") {
+    double sum = 0;
+    for (int i = 0; i < writes; ++i) {
+      pipeline.Set<PipelineSpot>(++spot);
+      sum += pipeline.Value<PipelineStage<stage_count - 1>>();
+    }
+    return sum;
+  };
+  // Writes which do not reach the stages cost a compare only.
+  BENCHMARK("write the static pipeline " + std::to_string(writes) + " times without changes") {
+    double sum = 0;
+    for (int i = 0; i < writes; ++i) {
+      pipeline.Set<PipelineSpot>(spot);
+      sum += pipeline.Value<PipelineStage<stage_count - 1>>();
+    }
+    return sum;
+  };
+
+  dtrack::DTrack global;
+  dtrack::DValue<double> dynamic_spot(global, 0.0);
+  dtrack::DValue<double> volatility(global, 0.001);
+  std::vector<dtrack::DTracker<double, double, double>> stages;
+  stages.reserve(stage_count);
+  stages.emplace_back(global, [] (const double& spot, const double& volatility) { return spot * (1 + volatility); });
+  stages.back().Watch<0>(dynamic_spot).Watch<1>(volatility);
+  for (int k = 1; k < stage_count; ++k) {
+    stages.emplace_back(global, [] (const double& previous, const double& volatility) { return previous * (1 + volatility) - volatility; });
+    stages.back().Watch<0>(stages[k - 1]).Watch<1>(volatility);
+  }
+  BENCHMARK("write and read the same " + std::to_string(stage_count) + " DTrackers " + std::to_string(writes) + " times") {
+    double sum = 0;
+    for (int i = 0; i < writes; ++i) {
+      dynamic_spot.SetValue(++spot);
+      sum += stages.back().Value();
+    }
+    return sum;
+  };
+  BENCHMARK("write the DTrackers " + std::to_string(writes) + " times without changes") {
+    double sum = 0;
+    for (int i = 0; i < writes; ++i) {
+      dynamic_spot.SetValue(spot);
+      sum += stages.back().Value();
+    }
+    return sum;
+  };
+}
+
+TEST_CASE("Benchmark memoizing a tracker flipping between modes", "[!benchmark]") {
+  const int flips = 100;
+  const int mode_count = 4;
+  dtrack::DTrack global;
+  std::vector<double> samples(100000);
+  std::mt19937 random(5);
+  std::uniform_real_distribution<double> sample(0, 1);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = sample(random);
+  }
+  dtrack::DValue<int> mode(global, 0);
+  // A power sum over every sample, the mode picks the power.
+  auto moment = [&samples] (const int& mode) {
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+      sum += std::pow(samples[i], mode + 1);
+    }
+    return sum;
+  };
+  dtrack::DTracker<double, int> plain(global, moment);
+  plain.Watch<0>(mode);
+  dtrack::DTracker<double, int> memoized(global, moment);
+  memoized.Watch<0>(mode).Memoize(mode_count);
+  int flip = 0;
+  BENCHMARK("flip a tracker between " + std::to_string(mode_count) + " modes " + std::to_string(flips) + " times") {
+    double sum = 0;
+    for (int i = 0; i < flips; ++i) {
+      mode.SetValue(++flip % mode_count);
+      sum += plain.Value();
+    }
+    return sum;
+  };
+  BENCHMARK("flip a memoizing tracker between " + std::to_string(mode_count) + " modes " + std::to_string(flips) + " times") {
+    double sum = 0;
+    for (int i = 0; i < flips; ++i) {
+      mode.SetValue(++flip % mode_count);
+      sum += memoized.Value();
+    }
+    return sum;
+  };
+  dtrack::MemoStatistics statistics = memoized.CacheStatistics();
+  WARN("the memo cache hit " << statistics.hits << " times, missed " << statistics.misses << " and evicted " << statistics.evictions);
+}
+
+#if defined(DTRACK_USE_COROUTINES)
+TEST_CASE("Benchmark the latency of an async tracker after a burst of writes", "[!benchmark]") {
+  const int burst = 100;
+  std::vector<double> samples(100000, 0.5);
+  dtrack::DTrack global;
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  dtrack::DValue<int> input(global, 0);
+  // About a hundred microseconds of work per calculation.
+  auto weigh = [&samples] (int value) {
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+      sum += samples[i] * (value + static_cast<int>(i % 7));
+    }
+    return sum;
+  };
+  int written = 0;
+
+  double synchronous_result = 0;
+  dtrack::DTracker<double, int> synchronous(global, [&weigh] (const int& value) { return weigh(value); });
+  synchronous.Watch<0>(input).Bind([&synchronous_result] (const double& value) { synchronous_result = value; });
+  BENCHMARK("deliver the result of a DTracker after " + std::to_string(burst) + " writes") {
+    for (int i = 0; i < burst; ++i) {
+      input.SetValue(++written);
+    }
+    return synchronous_result;
+  };
+  synchronous = dtrack::DTracker<double, int>(global, [] (const int&) { return 0.0; });
+
+  dtrack::AsyncQueue queue;
+  double async_result = 0;
+  dtrack::AsyncDTracker<double, int> async(global, queue.Executor(), [weigh] (dtrack::CancelToken, int value) -> dtrack::Task<double> {
+    co_return weigh(value);
+  });
+  async.Watch<0>(input).Bind([&async_result] (const double& value) { async_result = value; });
+  BENCHMARK("deliver the result of an async tracker after " + std::to_string(burst) + " writes") {
+    for (int i = 0; i < burst; ++i) {
+      input.SetValue(++written);
+    }
+    queue.RunPending();
+    return async_result;
+  };
+  CHECK(async.Ready());
+}
+#endif
@@ -0,0 +1,173 @@
+#ifndef BITOPS_H_
+#define BITOPS_H_
+
+#include <climits>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+
+#if defined(__cpp_lib_bitops) && __cpp_lib_bitops >= 201907L
+#include <bit>
+#define BITOPS_USE_STD
+#elif defined(__GNUC__) || defined(__clang__)
+#define BITOPS_USE_BUILTIN
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define BITOPS_USE_MSVC
+#endif
+
+// The intrinsics of msvc can not be evaluated at compile time.
+#if defined(BITOPS_USE_MSVC)
+#define BITOPS_CONSTEXPR inline
+#else
+#define BITOPS_CONSTEXPR constexpr
+#endif
+
+namespace bitops
+{
+  namespace detail
+  {
+    template<typename T>
+    constexpr int Width() {
+      return static_cast<int>(sizeof(T) * CHAR_BIT);
+    }
+
+    template<typename T>
+    constexpr int GenericCountTrailingZeros(T value) {
+      if (!value) {
+        return Width<T>();
+      }
+      int count = 0;
+      while (!(value & 1)) {
+        value = static_cast<T>(value >> 1);
+        ++count;
+      }
+      return count;
+    }
+
+    template<typename T>
+    constexpr int GenericCountLeadingZeros(T value) {
+      int count = Width<T>();
+      while (value) {
+        value = static_cast<T>(value >> 1);
+        --count;
+      }
+      return count;
+    }
+
+    template<typename T>
+    constexpr int GenericPopCount(T value) {
+      unsigned long long bits = value;
+      bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+      bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+      bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+      return static_cast<int>((bits * 0x0101010101010101ULL) >> 56);
+    }
+  }
+
+  // Number of zero bits below the lowest set bit, the width of T for 0.
+  template<typename T>
+  BITOPS_CONSTEXPR int CountTrailingZeros(T value) {
+    static_assert(std::is_unsigned<T>::value, "bit operations need an unsigned type");
+#if defined(BITOPS_USE_STD)
+    return std::countr_zero(value);
+#elif defined(BITOPS_USE_BUILTIN)
+    return !value
+      ? detail::Width<T>()
+      : sizeof(T) <= sizeof(unsigned int)
+        ? __builtin_ctz(static_cast<unsigned int>(value))
+        : __builtin_ctzll(static_cast<unsigned long long>(value));
+#elif defined(BITOPS_USE_MSVC)
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    if (sizeof(T) > sizeof(unsigned long)) {
+      return _BitScanForward64(&index, static_cast<unsigned __int64>(value)) ? static_cast<int>(index) : detail::Width<T>();
+    }
+#else
+    if (sizeof(T) > sizeof(unsigned long)) {
+      if (_BitScanForward(&index, static_cast<unsigned long>(value))) {
+        return static_cast<int>(index);
+      }
+      return _BitScanForward(&index, static_cast<unsigned long>(static_cast<unsigned __int64>(value) >> 32))
+        ? static_cast<int>(index) + 32
+        : detail::Width<T>();
+    }
+#endif
+    return _BitScanForward(&index, static_cast<unsigned long>(value)) ? static_cast<int>(index) : detail::Width<T>();
+#else
+    return detail::GenericCountTrailingZeros(value);
+#endif
+  }
+
+  // Number of zero bits above the highest set bit, the width of T for 0.
+  template<typename T>
+  BITOPS_CONSTEXPR int CountLeadingZeros(T value) {
+    static_assert(std::is_unsigned<T>::value, "bit operations need an unsigned type");
+#if defined(BITOPS_USE_STD)
+    return std::countl_zero(value);
+#elif defined(BITOPS_USE_BUILTIN)
+    return !value
+      ? detail::Width<T>()
+      : sizeof(T) <= sizeof(unsigned int)
+        ? __builtin_clz(static_cast<unsigned int>(value)) - (detail::Width<unsigned int>() - detail::Width<T>())
+        : __builtin_clzll(static_cast<unsigned long long>(value)) - (detail::Width<unsigned long long>() - detail::Width<T>());
+#elif defined(BITOPS_USE_MSVC)
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    if (sizeof(T) > sizeof(unsigned long)) {
+      return _BitScanReverse64(&index, static_cast<unsigned __int64>(value))
+        ? detail::Width<T>() - 1 - static_cast<int>(index)
+        : detail::Width<T>();
+    }
+#else
+    if (sizeof(T) > sizeof(unsigned long)) {
+      if (_BitScanReverse(&index, static_cast<unsigned long>(static_cast<unsigned __int64>(value) >> 32))) {
+        return 31 - static_cast<int>(index);
+      }
+      return _BitScanReverse(&index, static_cast<unsigned long>(value)) ? 63 - static_cast<int>(index) : 64;
+    }
+#endif
+    return _BitScanReverse(&index, static_cast<unsigned long>(value))
+      ? detail::Width<T>() - 1 - static_cast<int>(index)
+      : detail::Width<T>();
+#else
+    return detail::GenericCountLeadingZeros(value);
+#endif
+  }
+
+  template<typename T>
+  BITOPS_CONSTEXPR int PopCount(T value) {
+    static_assert(std::is_unsigned<T>::value, "bit operations need an unsigned type");
+#if defined(BITOPS_USE_STD)
+    return std::popcount(value);
+#elif defined(BITOPS_USE_BUILTIN)
+    return sizeof(T) <= sizeof(unsigned int)
+      ? __builtin_popcount(static_cast<unsigned int>(value))
+      : __builtin_popcountll(static_cast<unsigned long long>(value));
+#elif defined(BITOPS_USE_MSVC) && defined(__AVX__)
+    return sizeof(T) <= sizeof(unsigned int)
+      ? static_cast<int>(__popcnt(static_cast<unsigned int>(value)))
+      : static_cast<int>(__popcnt(static_cast<unsigned int>(value)))
+        + static_cast<int>(__popcnt(static_cast<unsigned int>(static_cast<unsigned __int64>(value) >> 32)));
+#else
+    return detail::GenericPopCount(value);
+#endif
+  }
+
+  // Index of the set bit which has n set bits below it, the width of T when there are not that many.
+  template<typename T>
+  BITOPS_CONSTEXPR int FindNthSet(T value, int n) {
+    static_assert(std::is_unsigned<T>::value, "bit operations need an unsigned type");
+    for (; n > 0 && value; --n) {
+      value = static_cast<T>(value & (value - 1));
+    }
+    return CountTrailingZeros(value);
+  }
+}
+
+#endif // BITOPS_H_
@@ -6,629 +6,4834 @@
 #include <list>
 #include <memory>
 #include <array>
-#include <unordered_map>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <tuple>
+#include <limits>
+#include <climits>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <type_traits>
+#include <new>
+#include <cstddef>
+#include "bitops.h"
+
+// Async trackers need the coroutines of C++20.
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <optional>
+#define DTRACK_USE_COROUTINES
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DTRACK_USE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DTRACK_USE_SSE2
+#endif
 
 namespace dtrack
 {
+  // Change policies decide whether a new value differs from the stored one. Watchers are only
+  // invalidated, and the new value only stored, when Changed returns true.
+  struct AlwaysInvalidate {
+    template<typename T>
+    bool Changed(const T&, const T&) const { return true; }
+  };
+
+  struct InequalityCompare {
+    template<typename T>
+    bool Changed(const T& old_value, const T& new_value) const { return old_value != new_value; }
+  };
+
+  // Compares the hashes only, a collision keeps the old value. Hash defaults to std::hash<T>.
+  template<typename Hash = void>
+  struct HashCompare {
+    template<typename T>
+    bool Changed(const T& old_value, const T& new_value) const {
+      std::conditional_t<std::is_void<Hash>::value, std::hash<T>, Hash> hash;
+      return hash(old_value) != hash(new_value);
+    }
+  };
+
+  // For types which count their own modifications and expose the count as Version().
+  struct VersionCompare {
+    template<typename T>
+    bool Changed(const T& old_value, const T& new_value) const { return old_value.Version() != new_value.Version(); }
+  };
+
+  // Compare is called as compare(old_value, new_value) and returns whether they differ.
+  template<typename Compare>
+  struct CustomCompare {
+    template<typename T>
+    bool Changed(const T& old_value, const T& new_value) { return compare(old_value, new_value); }
+
+    Compare compare;
+  };
+
+  // The policy of a DValue without an explicit one and of every DTracker computing a T.
+  template<typename T>
+  struct ChangePolicy {
+    typedef InequalityCompare type;
+  };
+
+  template<typename T, typename Policy = typename ChangePolicy<T>::type>
+  class DValue;
+
+  template<typename T, typename... N>
+  class DTracker;
+
+  template<typename T>
+  class DVector;
+
+  template<typename T>
+  class VectorDelta;
+
+  template<typename K, typename V>
+  class DMap;
+
+  template<typename T>
+  class DAutoTracker;
+
+  // Pull recalculates trackers when they are read or on DTrack::Apply. Push recalculates the
+  // trackers depending on a DValue as soon as it is written and calls their bound callbacks.
+  enum class UpdateMode {
+    Pull,
+    Push
+  };
+
+  // Single leaves a graph to one thread at a time. Concurrent lets any thread write DValues and
+  // create, watch or destroy trackers while one thread reads trackers and calls Apply. Bits are
+  // then changed atomically and the graph is guarded by a reader writer lock. Each DValue and
+  // DTracker object is still used by one thread at a time, and a tracker with a bound callback is
+  // destroyed on the reading thread. Concurrent graphs stay in pull mode and have no transactions.
+  enum class ThreadMode {
+    Single,
+    Concurrent
+  };
+
+  // Counts of invalid trackers brought up to date since the graph was created. A tracker none of
+  // whose inputs changed is only marked valid, which counts as a cutoff.
+  struct UpdateStatistics {
+    uint64_t recomputations;
+    uint64_t cutoffs;
+  };
+
+  // Counts of the lookups of a memoizing tracker since it started memoizing.
+  struct MemoStatistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
   namespace detail
   {
-    bool CheckBit(uintptr_t bits) {
+    inline bool CheckBit(uintptr_t bits) {
       return bits && !(bits & (bits - 1));
     }
 
+    // Returns the first word in [begin, end) which is not zero, or end. Runs of zero words are
+    // skipped a whole vector register pair at a time.
+    inline size_t FindNonZeroWord(const uintptr_t* words, size_t begin, size_t end) {
+      size_t word = begin;
+#if defined(DTRACK_USE_AVX2)
+      const size_t block = 2 * sizeof(__m256i) / sizeof(uintptr_t);
+      for (; word + block <= end; word += block) {
+        const __m256i* vectors = reinterpret_cast<const __m256i*>(words + word);
+        __m256i any = _mm256_or_si256(_mm256_loadu_si256(vectors), _mm256_loadu_si256(vectors + 1));
+        if (!_mm256_testz_si256(any, any)) {
+          break;
+        }
+      }
+#elif defined(DTRACK_USE_SSE2)
+      const size_t block = 2 * sizeof(__m128i) / sizeof(uintptr_t);
+      const __m128i zero = _mm_setzero_si128();
+      for (; word + block <= end; word += block) {
+        const __m128i* vectors = reinterpret_cast<const __m128i*>(words + word);
+        __m128i any = _mm_or_si128(_mm_loadu_si128(vectors), _mm_loadu_si128(vectors + 1));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) {
+          break;
+        }
+      }
+#endif
+      while (word < end && !words[word]) {
+        ++word;
+      }
+      return word;
+    }
+
+    template<typename F>
+    void ForEachNonZeroWord(const uintptr_t* words, size_t count, F&& visitor) {
+      for (
+        size_t word = FindNonZeroWord(words, 0, count);
+        word < count;
+        word = FindNonZeroWord(words, word + 1, count)
+      ) {
+        visitor(word, words[word]);
+      }
+    }
+
+    // Bitmap words in segments which never move once allocated, segment k holds kFirstSegment << k
+    // words. Bits are read and set while the bitmap grows, only Grow has to be serialized. A
+    // concurrent bitmap changes bits with atomic read modify writes, otherwise with plain loads
+    // and stores of the atomic words.
+    class SegmentedBitmap {
+    public:
+      explicit SegmentedBitmap(bool concurrent)
+        : segments_()
+        , size_(0)
+        , concurrent_(concurrent) {
+        for (size_t i = 0; i < kMaxSegments; ++i) {
+          segments_[i].store(nullptr, std::memory_order_relaxed);
+        }
+      }
+
+      ~SegmentedBitmap() {
+        for (size_t i = 0; i < kMaxSegments; ++i) {
+          delete[] segments_[i].load(std::memory_order_relaxed);
+        }
+      }
+
+      SegmentedBitmap(const SegmentedBitmap&) = delete;
+
+      SegmentedBitmap& operator=(const SegmentedBitmap&) = delete;
+
+      size_t Size() const { return size_.load(std::memory_order_acquire); }
+
+      void Grow(size_t words) {
+        size_t size = size_.load(std::memory_order_relaxed);
+        for (size_t segment = SegmentOf(size); size < words; ++segment) {
+          assert(segment < kMaxSegments);
+          segments_[segment].store(new std::atomic<uintptr_t>[kFirstSegment << segment](), std::memory_order_release);
+          size = size + (kFirstSegment << segment);
+          size_.store(size, std::memory_order_release);
+        }
+      }
+
+      uintptr_t Load(size_t word) const {
+        return At(word).load(std::memory_order_acquire);
+      }
+
+      // Returns the bits which were not set before.
+      uintptr_t Set(size_t word, uintptr_t bits) {
+        std::atomic<uintptr_t>& target = At(word);
+        if (concurrent_) {
+          return bits & (~target.fetch_or(bits, std::memory_order_acq_rel));
+        }
+        uintptr_t old_bits = target.load(std::memory_order_relaxed);
+        target.store(old_bits | bits, std::memory_order_relaxed);
+        return bits & (~old_bits);
+      }
+
+      void Clear(size_t word, uintptr_t bits) {
+        std::atomic<uintptr_t>& target = At(word);
+        if (concurrent_) {
+          target.fetch_and(~bits, std::memory_order_acq_rel);
+        } else {
+          target.store(target.load(std::memory_order_relaxed) & (~bits), std::memory_order_relaxed);
+        }
+      }
+
+      // Calls visitor with every word which is not zero and its bits, in word order.
+      template<typename F>
+      void ForEachNonZeroWord(F&& visitor) const {
+        static_assert(sizeof(std::atomic<uintptr_t>) == sizeof(uintptr_t), "the words are scanned as plain integers");
+        size_t size = Size();
+        size_t first = 0;
+        for (size_t segment = 0; first < size; ++segment) {
+          const std::atomic<uintptr_t>* words = segments_[segment].load(std::memory_order_acquire);
+          size_t count = kFirstSegment << segment;
+          if (concurrent_) {
+            for (size_t i = 0; i < count; ++i) {
+              uintptr_t bits = words[i].load(std::memory_order_relaxed);
+              if (bits) {
+                visitor(first + i, bits);
+              }
+            }
+          } else {
+            // Nothing changes the bits during the scan, the vector scan reads them as integers.
+            detail::ForEachNonZeroWord(
+              reinterpret_cast<const uintptr_t*>(words),
+              count,
+              [&visitor, first] (size_t word, uintptr_t bits) {
+                visitor(first + word, bits);
+              }
+            );
+          }
+          first = first + count;
+        }
+      }
+
+    private:
+      static const size_t kFirstSegment = 64;
+
+      static const size_t kMaxSegments = 40;
+
+      // The segment holding word, which is also the number of segments in front of it.
+      static size_t SegmentOf(size_t word) {
+        return static_cast<size_t>(std::numeric_limits<size_t>::digits - bitops::CountLeadingZeros(word / kFirstSegment + 1) - 1);
+      }
+
+      std::atomic<uintptr_t>& At(size_t word) const {
+        size_t segment = SegmentOf(word);
+        assert(word < Size());
+        return segments_[segment].load(std::memory_order_acquire)[word - kFirstSegment * ((static_cast<size_t>(1) << segment) - 1)];
+      }
+
+      std::array<std::atomic<std::atomic<uintptr_t>*>, kMaxSegments> segments_;
+      std::atomic<size_t> size_;
+      bool concurrent_;
+    };
+
+    class GlobalBlock;
+    class TrackerPosition;
+    class TrackableBase;
+    struct VersionBase;
+
+    // What GlobalBlock calls back on the tracker owning a position. Every tracker type has one
+    // static table, the tracker itself is passed as the context.
+    struct TrackerHooks {
+      void (*apply)(void* tracker);
+      void (*update)(void* tracker);
+      // Brings the inputs up to date on the draining thread, evaluate may then run on a worker
+      // and only reads them.
+      void (*refresh)(void* tracker);
+      bool (*evaluate)(void* tracker);
+      // Whether every tracker read as an input is still valid.
+      bool (*inputs_valid)(void* tracker);
+      // Evaluating changes what the tracker watches, which only the draining thread may do.
+      bool serial;
+    };
+
+    class PositionAllocator {
+    public:
+      PositionAllocator()
+        : levels_() {
+
+      }
+
+      std::tuple<size_t, uintptr_t> Allocate();
+
+      void Free(const std::tuple<size_t, uintptr_t>& position);
+
+      uintptr_t Occupied(size_t word) const {
+        if (levels_.empty() || word >= levels_[0].size()) {
+          return 0;
+        }
+        return levels_[0][word];
+      }
+
+    private:
+      size_t Grow();
+
+      // levels_[0][w] holds the occupied bits of word w, a bit of levels_[k][i] is set
+      // when the word i * bits + bit of levels_[k - 1] is full.
+      std::vector<std::vector<uintptr_t>> levels_;
+    };
+
+    // Tracker positions grouped by word and sorted by word. The first N words are kept inline, a value
+    // watched by a handful of trackers does not allocate; more words move to an array on the heap.
     template<size_t N>
-    struct FirstSetBitForward {
+    class PositionSet {
+    public:
+      typedef std::tuple<size_t, uintptr_t> Position;
+
+      PositionSet()
+        : size_(0)
+        , capacity_(N)
+        , heap_(nullptr)
+        , inline_() {
+
+      }
+
+      ~PositionSet() {
+        delete[] heap_;
+      }
+
+      PositionSet(const PositionSet&) = delete;
+
+      PositionSet& operator=(const PositionSet&) = delete;
+
+      const Position* begin() const { return heap_ ? heap_ : inline_; }
+
+      const Position* end() const { return begin() + size_; }
+
+      size_t size() const { return size_; }
+
+      bool empty() const { return size_ == 0; }
+
+      void Insert(const Position& position) {
+        Position* data = Data();
+        Position* it = std::lower_bound(data, data + size_, position, WordLess);
+        if (it != data + size_ && std::get<0>(*it) == std::get<0>(position)) {
+          std::get<1>(*it) = std::get<1>(*it) | std::get<1>(position);
+          return;
+        }
+        size_t index = it - data;
+        if (size_ == capacity_) {
+          Grow();
+          data = Data();
+        }
+        std::move_backward(data + index, data + size_, data + size_ + 1);
+        data[index] = position;
+        ++size_;
+      }
+
+      // Clears the bits of position, the word is dropped once none of its bits is left.
+      void Erase(const Position& position) {
+        Position* data = Data();
+        Position* it = std::lower_bound(data, data + size_, position, WordLess);
+        assert(it != data + size_ && std::get<0>(*it) == std::get<0>(position));
+        std::get<1>(*it) = std::get<1>(*it) & (~std::get<1>(position));
+        if (std::get<1>(*it) == 0) {
+          std::move(it + 1, data + size_, it);
+          --size_;
+        }
+      }
+
+    private:
+      static bool WordLess(const Position& lhs, const Position& rhs) {
+        return std::get<0>(lhs) < std::get<0>(rhs);
+      }
+
+      Position* Data() { return heap_ ? heap_ : inline_; }
+
+      void Grow() {
+        uint32_t capacity = capacity_ * 2;
+        Position* heap = new Position[capacity];
+        std::copy(Data(), Data() + size_, heap);
+        delete[] heap_;
+        heap_ = heap;
+        capacity_ = capacity;
+      }
+
+      uint32_t size_;
+      uint32_t capacity_;
+      Position* heap_;
+      Position inline_[N];
+    };
+
+    typedef PositionSet<4> TrackedPositionSet;
+
+    // Blocks for the graph objects of one GlobalBlock, carved from large chunks. Freed blocks go to
+    // the free list of their size class and are handed out again first, chunks are only released
+    // together with the pool. Blocks too large for a chunk come from operator new. A synchronized
+    // pool serves several threads under a mutex.
+    class NodePool {
+    public:
+      explicit NodePool(bool synchronized = false)
+        : free_lists_()
+        , chunks_()
+        , chunk_used_(0)
+        , mutex_()
+        , synchronized_(synchronized)
+#if !defined(NDEBUG)
+        , live_blocks_(0)
+#endif
+      {
+
+      }
+
+      ~NodePool() {
+        assert(live_blocks_ == 0 && "graph nodes must not outlive their DTrack");
+      }
+
+      NodePool(const NodePool&) = delete;
+
+      NodePool& operator=(const NodePool&) = delete;
+
+      bool Synchronized() const { return synchronized_; }
+
+      void* Allocate(size_t size) {
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        if (synchronized_) {
+          lock.lock();
+        }
+#if !defined(NDEBUG)
+        ++live_blocks_;
+#endif
+        size_t size_class = (size + sizeof(Block) - 1) / sizeof(Block);
+        if (size_class > kChunkBlocks / 4) {
+          return ::operator new(size);
+        }
+        if (size_class >= free_lists_.size()) {
+          free_lists_.resize(size_class + 1, nullptr);
+        }
+        if (free_lists_[size_class]) {
+          void* block = free_lists_[size_class];
+          free_lists_[size_class] = *static_cast<void**>(block);
+          return block;
+        }
+        if (chunks_.empty() || chunk_used_ + size_class > kChunkBlocks) {
+          chunks_.emplace_back(new Block[kChunkBlocks]);
+          chunk_used_ = 0;
+        }
+        void* block = chunks_.back().get() + chunk_used_;
+        chunk_used_ += size_class;
+        return block;
+      }
+
+      void Free(void* block, size_t size) {
+        std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+        if (synchronized_) {
+          lock.lock();
+        }
+#if !defined(NDEBUG)
+        --live_blocks_;
+#endif
+        size_t size_class = (size + sizeof(Block) - 1) / sizeof(Block);
+        if (size_class > kChunkBlocks / 4) {
+          ::operator delete(block);
+          return;
+        }
+        *static_cast<void**>(block) = free_lists_[size_class];
+        free_lists_[size_class] = block;
+      }
+
+    private:
+      typedef std::max_align_t Block;
+
+      static const size_t kChunkBlocks = 4096;
+
+      std::vector<void*> free_lists_;
+      std::vector<std::unique_ptr<Block[]>> chunks_;
+      size_t chunk_used_;
+      std::mutex mutex_;
+      bool synchronized_;
+#if !defined(NDEBUG)
+      size_t live_blocks_;
+#endif
+    };
+
+    template<typename T>
+    class NodeRef;
+
+    template<typename T, typename... A>
+    NodeRef<T> MakeNode(NodePool& pool, A&&... args);
+
+    // Graph objects are reference counted intrusively. Handles of a concurrent graph are copied
+    // and dropped on any thread, there the counts are atomic, elsewhere plain loads and stores do.
+    // The last reference is dropped under the exclusive lock of the graph.
+    class Node {
+    public:
+      Node()
+        : references_(0)
+        , synchronized_(false)
+        , destroy_(nullptr) {
+
+      }
+
+      Node(const Node&) = delete;
+
+      Node& operator=(const Node&) = delete;
+
+    private:
+      template<typename T>
+      friend class NodeRef;
+      template<typename T, typename... A>
+      friend NodeRef<T> MakeNode(NodePool& pool, A&&... args);
+
+      void Retain() {
+        if (synchronized_) {
+          references_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        references_.store(references_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+
+      // Returns true when the last reference is gone.
+      bool Release() {
+        if (synchronized_) {
+          return references_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+        uint32_t references = references_.load(std::memory_order_relaxed) - 1;
+        references_.store(references, std::memory_order_relaxed);
+        return references == 0;
+      }
+
+      std::atomic<uint32_t> references_;
+      bool synchronized_;
+      void (*destroy_)(Node* node);
+    };
+
+    template<typename T>
+    class NodeRef {
+    public:
+      NodeRef()
+        : node_(nullptr) {
+
+      }
+
+      explicit NodeRef(T* node)
+        : node_(node) {
+        Retain();
+      }
+
+      NodeRef(const NodeRef& another)
+        : node_(another.node_) {
+        Retain();
+      }
+
+      NodeRef(NodeRef&& another)
+        : node_(another.node_) {
+        another.node_ = nullptr;
+      }
+
+      template<typename U>
+      NodeRef(const NodeRef<U>& another)
+        : node_(another.get()) {
+        Retain();
+      }
+
+      ~NodeRef() {
+        Release();
+      }
+
+      NodeRef& operator=(NodeRef another) {
+        std::swap(node_, another.node_);
+        return *this;
+      }
+
+      void reset() {
+        Release();
+        node_ = nullptr;
+      }
+
+      T* get() const { return node_; }
+
+      T* operator->() const { return node_; }
+
+      T& operator*() const { return *node_; }
+
+      explicit operator bool() const { return node_ != nullptr; }
+
+    private:
+      void Retain() {
+        if (node_) {
+          static_cast<Node*>(node_)->Retain();
+        }
+      }
+
+      void Release() {
+        if (node_ && static_cast<Node*>(node_)->Release()) {
+          Node* node = node_;
+          node->destroy_(node);
+        }
+      }
 
+      T* node_;
     };
 
-    template<>
-    struct FirstSetBitForward<sizeof(unsigned long)> {
-      std::tuple<bool, size_t> operator()(unsigned long value) {
-        unsigned long index;
-        if (_BitScanForward(
-          &index,
-          value
-        )) {
-          return std::make_tuple(true, index);
+    // Runs index ranges on a fixed set of threads, the calling thread included. Every worker owns a
+    // queue of ranges and steals from the back of the other queues once its own queue is empty.
+    class WorkStealingPool {
+    public:
+      explicit WorkStealingPool(size_t worker_count)
+        : queues_(worker_count)
+        , workers_()
+        , mutex_()
+        , work_ready_()
+        , work_done_()
+        , generation_(0)
+        , pending_(0)
+        , stopped_(false) {
+        for (size_t i = 1; i < worker_count; ++i) {
+          workers_.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+        }
+      }
+
+      ~WorkStealingPool() {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stopped_ = true;
+        }
+        work_ready_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i) {
+          workers_[i].join();
+        }
+      }
+
+      WorkStealingPool(const WorkStealingPool&) = delete;
+
+      WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+      size_t WorkerCount() const { return queues_.size(); }
+
+      void Run(size_t count, const std::function<void(size_t)>& task) {
+        if (count == 0) {
+          return;
+        }
+        pending_.store(count);
+        size_t chunk = std::max<size_t>(1, count / (queues_.size() * 4));
+        for (size_t begin = 0, queue = 0; begin < count; begin += chunk, ++queue) {
+          Queue& target = queues_[queue % queues_.size()];
+          std::lock_guard<std::mutex> lock(target.mutex);
+          target.ranges.emplace_back(&task, begin, std::min(count, begin + chunk));
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          ++generation_;
+        }
+        work_ready_.notify_all();
+        Work(0);
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_done_.wait(lock, [this] { return pending_.load() == 0; });
+      }
+
+    private:
+      typedef std::tuple<const std::function<void(size_t)>*, size_t, size_t> Range;
+
+      struct Queue {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+      };
+
+      bool Pop(size_t worker, Range& range) {
+        {
+          Queue& own = queues_[worker];
+          std::lock_guard<std::mutex> lock(own.mutex);
+          if (!own.ranges.empty()) {
+            range = own.ranges.front();
+            own.ranges.pop_front();
+            return true;
+          }
+        }
+        for (size_t i = 1; i < queues_.size(); ++i) {
+          Queue& victim = queues_[(worker + i) % queues_.size()];
+          std::lock_guard<std::mutex> lock(victim.mutex);
+          if (!victim.ranges.empty()) {
+            range = victim.ranges.back();
+            victim.ranges.pop_back();
+            return true;
+          }
+        }
+        return false;
+      }
+
+      void Work(size_t worker) {
+        Range range;
+        while (Pop(worker, range)) {
+          for (size_t i = std::get<1>(range); i < std::get<2>(range); ++i) {
+            (*std::get<0>(range))(i);
+          }
+          size_t done = std::get<2>(range) - std::get<1>(range);
+          if (pending_.fetch_sub(done) == done) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            work_done_.notify_all();
+          }
+        }
+      }
+
+      void WorkerLoop(size_t worker) {
+        size_t generation = 0;
+        while (true) {
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_ready_.wait(lock, [this, generation] { return stopped_ || generation_ != generation; });
+            if (stopped_) {
+              return;
+            }
+            generation = generation_;
+          }
+          Work(worker);
         }
-        return std::make_tuple(false, 0);
       }
+
+      std::vector<Queue> queues_;
+      std::vector<std::thread> workers_;
+      std::mutex mutex_;
+      std::condition_variable work_ready_;
+      std::condition_variable work_done_;
+      size_t generation_;
+      std::atomic<size_t> pending_;
+      bool stopped_;
     };
 
-    template<>
-    struct FirstSetBitForward<sizeof(unsigned __int64)> {
-      std::tuple<bool, size_t> operator()(unsigned __int64 value) {
-        unsigned long index;
-        if (_BitScanForward64(
-          &index,
-          value
-        )) {
-          return std::make_tuple(true, index);
+    // Everything GlobalBlock knows about a tracker is kept in vectors indexed by its slot, the
+    // word of its position times the bits of a word plus the index of its bit.
+    class GlobalBlock {
+    public:
+      explicit GlobalBlock(ThreadMode thread_mode = ThreadMode::Single)
+        : positions_()
+        , trackers_validation_status_(thread_mode == ThreadMode::Concurrent)
+        , trackers_changed_inputs_(thread_mode == ThreadMode::Concurrent)
+        , trackers_()
+        , trackers_output_()
+        , trackers_height_()
+        , trackers_generation_()
+        , trackers_queued_()
+        , apply_levels_()
+        , apply_changed_()
+        , apply_generations_()
+        , lowest_queued_(std::numeric_limits<size_t>::max())
+        , draining_(false)
+        , drains_(0)
+        , mode_(UpdateMode::Pull)
+        , statistics_()
+        , transaction_depth_(0)
+        , deferred_values_()
+        , transaction_seeds_()
+        , transaction_words_()
+        , pool_()
+        , nodes_(thread_mode == ThreadMode::Concurrent)
+        , graph_mutex_()
+        , concurrent_(thread_mode == ThreadMode::Concurrent)
+        , snapshots_(false)
+        , epoch_(1)
+        , reader_epochs_()
+        , reader_waiters_(0)
+        , reader_slots_mutex_()
+        , reader_slot_freed_()
+        , unpublished_mutex_()
+        , unpublished_()
+        , publishing_()
+        , trimmable_()
+        , pinned_epochs_()
+        , retired_versions_()
+        , retired_epochs_() {
+        for (size_t i = 0; i < kReaderSlots; ++i) {
+          reader_epochs_[i].store(0, std::memory_order_relaxed);
+        }
+      }
+
+      ~GlobalBlock();
+
+      GlobalBlock(const GlobalBlock&) = delete;
+
+      GlobalBlock& operator=(const GlobalBlock& another) = delete;
+
+      void AllocatePosition(TrackerPosition* tracker_position, const TrackableBase* output);
+
+      void FreePosition(const TrackerPosition* tracker_position);
+
+      NodePool& Nodes() { return nodes_; }
+
+      bool Concurrent() const { return concurrent_; }
+
+      // Held while changing the graph or a value, only taken in concurrent mode.
+      std::unique_lock<std::shared_timed_mutex> LockExclusive() {
+        return concurrent_
+          ? std::unique_lock<std::shared_timed_mutex>(graph_mutex_)
+          : std::unique_lock<std::shared_timed_mutex>();
+      }
+
+      // Held while reading the graph or values and while propagating invalidation, only taken in
+      // concurrent mode.
+      std::shared_lock<std::shared_timed_mutex> LockShared() {
+        return concurrent_
+          ? std::shared_lock<std::shared_timed_mutex>(graph_mutex_)
+          : std::shared_lock<std::shared_timed_mutex>();
+      }
+
+      void Apply();
+
+      // Recalculates the queued trackers. Does nothing when called from a callback of a running
+      // drain, that drain picks up whatever the callback queued.
+      void Drain();
+
+      // Counts the finished drains, those of Apply and any in push mode. In pull mode the watchers
+      // of a value written by a callback stay invalid past the drain.
+      uint64_t Drains() const { return drains_.load(std::memory_order_relaxed); }
+
+      void SetWorkerCount(size_t worker_count);
+
+      void SetUpdateMode(UpdateMode mode);
+
+      UpdateMode Mode() const { return mode_; }
+
+      void CommitValidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position);
+
+      // Commits a tracker done with its evaluation as valid.
+      void CommitValidatedTracker(TrackerPosition* tracker);
+
+      void CommitInvalidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position);
+
+      void CommitInvalidatedPositions(const TrackedPositionSet& tracker_positions);
+
+      bool IsPositionValid(const std::tuple<size_t, uintptr_t>& tracker_position) const;
+
+      bool HasChangedInputs(const std::tuple<size_t, uintptr_t>& tracker_position) const {
+        assert(CheckBit(std::get<1>(tracker_position)));
+        return (trackers_changed_inputs_.Load(std::get<0>(tracker_position)) & std::get<1>(tracker_position)) != 0;
+      }
+
+      const UpdateStatistics& Statistics() const { return statistics_; }
+
+      // Has to be called before the first value is created.
+      void EnableSnapshots() { snapshots_ = true; }
+
+      bool SnapshotsEnabled() const { return snapshots_; }
+
+      // Queues value to be published with the next epoch, copy makes its new version.
+      void MarkUnpublished(TrackableBase* value, VersionBase* (*copy)(const TrackableBase* value, uint64_t epoch));
+
+      // Publishes the values changed since the last epoch as a new one, then frees the versions
+      // which no pinned epoch can reach any more.
+      void PublishEpoch();
+
+      // Epochs pinned at once at most.
+      static const size_t kReaderSlots = 64;
+
+      // Claims a reader slot holding the latest epoch and returns the slot. Waits for a slot to be
+      // unpinned while all of them are taken.
+      size_t PinEpoch(uint64_t& epoch);
+
+      void UnpinEpoch(size_t slot) {
+        reader_epochs_[slot].store(0, std::memory_order_seq_cst);
+        if (reader_waiters_.load(std::memory_order_seq_cst)) {
+          std::lock_guard<std::mutex> lock(reader_slots_mutex_);
+          reader_slot_freed_.notify_all();
+        }
+      }
+
+      void BeginTransaction() {
+        assert(!concurrent_ && "concurrent graphs have no transactions");
+        ++transaction_depth_;
+      }
+
+      // Invalidates the watchers of every value written since the outermost BeginTransaction in
+      // one propagation and recalculates them in one drain when in push mode.
+      void EndTransaction();
+
+      bool InTransaction() const { return transaction_depth_ > 0; }
+
+      void Defer(TrackableBase* value) { deferred_values_.push_back(value); }
+
+      void CancelDeferred(TrackableBase* value) {
+        deferred_values_.erase(std::find(deferred_values_.begin(), deferred_values_.end(), value));
+      }
+
+      void CountUpdate(bool recomputed) {
+        ++(recomputed ? statistics_.recomputations : statistics_.cutoffs);
+      }
+
+      size_t Height(const std::tuple<size_t, uintptr_t>& tracker_position) const {
+        return trackers_height_[Slot(tracker_position)];
+      }
+
+      void RaiseHeight(const std::tuple<size_t, uintptr_t>& tracker_position, size_t height);
+
+      // Calls visitor with the slot of every invalid tracker, in slot order.
+      template<typename F>
+      void ForEachInvalidTracker(F&& visitor) const {
+        trackers_validation_status_.ForEachNonZeroWord(
+          [&visitor] (size_t word, uintptr_t invalid) {
+            while (invalid) {
+              size_t slot = word * (sizeof(uintptr_t) * CHAR_BIT) + bitops::CountTrailingZeros(invalid);
+              invalid = invalid & (invalid - 1);
+              visitor(slot);
+            }
+          }
+        );
+      }
+
+    private:
+      static size_t Slot(const std::tuple<size_t, uintptr_t>& tracker_position) {
+        assert(CheckBit(std::get<1>(tracker_position)));
+        return std::get<0>(tracker_position) * (sizeof(uintptr_t) * CHAR_BIT)
+          + bitops::CountTrailingZeros(std::get<1>(tracker_position));
+      }
+
+      static std::tuple<size_t, uintptr_t> SlotPosition(size_t slot) {
+        return std::make_tuple(
+          slot / (sizeof(uintptr_t) * CHAR_BIT),
+          static_cast<uintptr_t>(1) << (slot % (sizeof(uintptr_t) * CHAR_BIT))
+        );
+      }
+
+      // Null when the slot was freed, or freed and taken by another tracker, since generation.
+      TrackerPosition* TrackerAt(size_t slot, uint32_t generation) {
+        std::shared_lock<std::shared_timed_mutex> lock = LockShared();
+        return trackers_generation_[slot] == generation ? trackers_[slot] : nullptr;
+      }
+
+      // Each thread walks its own worklist, writers of a concurrent graph propagate side by side.
+      static std::vector<std::tuple<size_t, uintptr_t>>& PropagationQueue() {
+        static thread_local std::vector<std::tuple<size_t, uintptr_t>> queue;
+        return queue;
+      }
+
+      void PropagateInvalidation(std::vector<std::tuple<size_t, uintptr_t>>& queue);
+
+      void Enqueue(size_t slot);
+
+      PositionAllocator positions_;
+      SegmentedBitmap trackers_validation_status_;
+      // A set bit marks an invalid tracker which has an input that really changed, the rest of an
+      // invalid cone only may have to be recalculated.
+      SegmentedBitmap trackers_changed_inputs_;
+      std::vector<TrackerPosition*> trackers_;
+      std::vector<const TrackableBase*> trackers_output_;
+      std::vector<size_t> trackers_height_;
+      std::vector<uint32_t> trackers_generation_;
+      std::vector<char> trackers_queued_;
+      // Queued slots bucketed by height, lowest_queued_ is the lowest height which may hold any.
+      std::vector<std::vector<size_t>> apply_levels_;
+      std::vector<char> apply_changed_;
+      // The generation of each slot of the level being applied, taken while the lock is held.
+      std::vector<uint32_t> apply_generations_;
+      size_t lowest_queued_;
+      bool draining_;
+      std::atomic<uint64_t> drains_;
+      UpdateMode mode_;
+      UpdateStatistics statistics_;
+      size_t transaction_depth_;
+      std::vector<TrackableBase*> deferred_values_;
+      // Watcher bits of the deferred values merged per word, transaction_words_ lists the words in use.
+      std::vector<uintptr_t> transaction_seeds_;
+      std::vector<size_t> transaction_words_;
+      std::unique_ptr<WorkStealingPool> pool_;
+      NodePool nodes_;
+      std::shared_timed_mutex graph_mutex_;
+      bool concurrent_;
+      bool snapshots_;
+      std::atomic<uint64_t> epoch_;
+      // The epoch pinned by each reader, 0 for a free slot.
+      std::array<std::atomic<uint64_t>, kReaderSlots> reader_epochs_;
+      // Readers waiting for a slot, only they make UnpinEpoch take the mutex.
+      std::atomic<size_t> reader_waiters_;
+      std::mutex reader_slots_mutex_;
+      std::condition_variable reader_slot_freed_;
+      struct UnpublishedValue {
+        NodeRef<TrackableBase> value;
+        VersionBase* (*copy)(const TrackableBase* value, uint64_t epoch);
+      };
+      std::mutex unpublished_mutex_;
+      // Declared after nodes_, the values held here go back to the pool before it is destroyed.
+      std::vector<UnpublishedValue> unpublished_;
+      std::vector<UnpublishedValue> publishing_;
+      // Values which keep versions older than their latest one.
+      std::vector<NodeRef<TrackableBase>> trimmable_;
+      std::vector<uint64_t> pinned_epochs_;
+      // Unlinked versions and the epoch published when they were unlinked.
+      std::vector<VersionBase*> retired_versions_;
+      std::vector<uint64_t> retired_epochs_;
+    };
+
+    // Destroys a node made by MakeNode and returns its block to the pool.
+    template<typename T>
+    void DestroyNode(Node* node) {
+      T* object = static_cast<T*>(node);
+      GlobalBlock* global_block = object->Block();
+      object->~T();
+      global_block->Nodes().Free(object, sizeof(T));
+    }
+
+    template<typename T, typename... A>
+    NodeRef<T> MakeNode(NodePool& pool, A&&... args) {
+      static_assert(alignof(T) <= alignof(std::max_align_t), "graph objects can not be over aligned");
+      T* node = new (pool.Allocate(sizeof(T))) T(std::forward<A>(args)...);
+      node->synchronized_ = pool.Synchronized();
+      node->destroy_ = &DestroyNode<T>;
+      return NodeRef<T>(node);
+    }
+
+    // Lives inside its tracker, GlobalBlock assigns the position in AllocatePosition.
+    class TrackerPosition {
+    public:
+      TrackerPosition(const TrackerHooks* hooks, void* tracker)
+        : hooks_(hooks)
+        , tracker_(tracker)
+        , position_()
+        , generation_(0) {
+
+      }
+
+      TrackerPosition(const TrackerPosition&) = delete;
+
+      TrackerPosition& operator=(const TrackerPosition&) = delete;
+
+      void NotifyApply() {
+        hooks_->apply(tracker_);
+      }
+
+      void NotifyUpdate() {
+        hooks_->update(tracker_);
+      }
+
+      void Refresh() {
+        hooks_->refresh(tracker_);
+      }
+
+      bool Evaluate() {
+        return hooks_->evaluate(tracker_);
+      }
+
+      bool InputsValid() {
+        return hooks_->inputs_valid(tracker_);
+      }
+
+      bool Serial() const { return hooks_->serial; }
+
+      std::tuple<size_t, uintptr_t> Position() const { return position_; }
+
+      uint32_t Generation() const { return generation_; }
+
+    private:
+      friend class GlobalBlock;
+
+      const TrackerHooks* hooks_;
+      void* tracker_;
+      std::tuple<size_t, uintptr_t> position_;
+      uint32_t generation_;
+    };
+
+    // A value of a Trackable published with an epoch, linked to the version it replaced.
+    struct VersionBase {
+      VersionBase(uint64_t published_epoch, void (*destroy_version)(VersionBase* version))
+        : epoch(published_epoch)
+        , older(nullptr)
+        , destroy(destroy_version) {
+
+      }
+
+      uint64_t epoch;
+      std::atomic<VersionBase*> older;
+      void (*destroy)(VersionBase* version);
+    };
+
+    // What a version keeps of a value. A value which shares state with the live graph, as a
+    // VectorDelta does, is copied deep so that later writes do not show through snapshots.
+    template<typename T>
+    const T& PublishedCopy(const T& value) {
+      return value;
+    }
+
+    template<typename T>
+    VectorDelta<T> PublishedCopy(const VectorDelta<T>& delta);
+
+    template<typename T>
+    struct Version : VersionBase {
+      Version(uint64_t published_epoch, const T& published_value)
+        : VersionBase(published_epoch, &Version::Destroy)
+        , value(published_value) {
+
+      }
+
+      static void Destroy(VersionBase* version) {
+        delete static_cast<Version*>(version);
+      }
+
+      T value;
+    };
+
+    class TrackableBase : public Node {
+    public:
+      TrackableBase(GlobalBlock* global_block)
+        : global_block_(global_block)
+        , source_(nullptr)
+        , tracked_positions_()
+        , versions_(nullptr)
+        , deferred_(false)
+        , unpublished_(false)
+        , trimmable_(false) {
+
+      }
+
+      ~TrackableBase() {
+        if (deferred_) {
+          global_block_->CancelDeferred(this);
+        }
+        DestroyVersions(versions_.load(std::memory_order_relaxed));
+      }
+
+      TrackableBase(const TrackableBase&) = delete;
+
+      TrackableBase& operator=(const TrackableBase&) = delete;
+
+      void Invalidate() {
+        global_block_->CommitInvalidatedPositions(tracked_positions_);
+      }
+
+      // Invalidates the watchers after a write, inside a transaction only once it ends.
+      void Publish() {
+        if (global_block_->InTransaction()) {
+          if (!deferred_) {
+            deferred_ = true;
+            global_block_->Defer(this);
+          }
+          return;
+        }
+        {
+          std::shared_lock<std::shared_timed_mutex> lock = global_block_->LockShared();
+          Invalidate();
+        }
+        if (global_block_->Mode() == UpdateMode::Push) {
+          global_block_->Drain();
+        }
+      }
+
+      bool Deferred() const { return deferred_; }
+
+      void ClearDeferred() { deferred_ = false; }
+
+      void Track(const std::tuple<size_t, uintptr_t>& position) {
+        assert(CheckBit(std::get<1>(position)));
+        tracked_positions_.Insert(position);
+      }
+
+      void StopTrack(const std::tuple<size_t, uintptr_t>& position) {
+        assert(CheckBit(std::get<1>(position)));
+        tracked_positions_.Erase(position);
+      }
+
+      const TrackedPositionSet& TrackedPositions() const { return tracked_positions_; }
+
+      GlobalBlock* Block() const { return global_block_; }
+
+      TrackerPosition* Source() const { return source_; }
+
+      void SetSource(TrackerPosition* source) { source_ = source; }
+
+      bool IsSourceValid() const {
+        return !source_ || global_block_->IsPositionValid(source_->Position());
+      }
+
+      void Refresh() const {
+        if (!IsSourceValid()) {
+          source_->NotifyUpdate();
+        }
+      }
+
+      // The latest version published at or before epoch, null when there is none.
+      const VersionBase* VersionAt(uint64_t epoch) const {
+        const VersionBase* version = versions_.load(std::memory_order_acquire);
+        while (version && version->epoch > epoch) {
+          version = version->older.load(std::memory_order_acquire);
+        }
+        return version;
+      }
+
+    protected:
+      GlobalBlock* global_block_;
+      TrackerPosition* source_;
+      TrackedPositionSet tracked_positions_;
+
+    private:
+      friend class GlobalBlock;
+
+      static void DestroyVersions(VersionBase* version) {
+        while (version) {
+          VersionBase* older = version->older.load(std::memory_order_relaxed);
+          version->destroy(version);
+          version = older;
+        }
+      }
+
+      void PushVersion(VersionBase* version) {
+        version->older.store(versions_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        versions_.store(version, std::memory_order_release);
+      }
+
+      // Unlinks the older versions which none of the sorted pinned epochs reads, a version is read
+      // by the epochs from its own up to the one of the version replacing it. Readers may still
+      // be walking through them, so they go to retired instead of being freed. Returns whether
+      // older versions are left.
+      bool TrimVersions(const std::vector<uint64_t>& pinned, std::vector<VersionBase*>& retired) {
+        VersionBase* newer = versions_.load(std::memory_order_relaxed);
+        VersionBase* version = newer->older.load(std::memory_order_relaxed);
+        while (version) {
+          VersionBase* older = version->older.load(std::memory_order_relaxed);
+          std::vector<uint64_t>::const_iterator reader = std::lower_bound(pinned.begin(), pinned.end(), version->epoch);
+          if (reader != pinned.end() && *reader < newer->epoch) {
+            newer = version;
+          } else {
+            newer->older.store(older, std::memory_order_release);
+            retired.push_back(version);
+          }
+          version = older;
+        }
+        return versions_.load(std::memory_order_relaxed)->older.load(std::memory_order_relaxed) != nullptr;
+      }
+
+      // Newest first, written only by the thread publishing epochs.
+      std::atomic<VersionBase*> versions_;
+      bool deferred_;
+      // Guarded by GlobalBlock, queued for the next epoch and keeping older versions.
+      bool unpublished_;
+      bool trimmable_;
+    };
+
+    template<typename T>
+    class Trackable : public TrackableBase {
+    public:
+      Trackable(GlobalBlock* global_block)
+        : TrackableBase(global_block)
+        , value_() {
+        MarkChanged();
+      }
+
+      Trackable(GlobalBlock* global_block, const T& default_value)
+        : TrackableBase(global_block)
+        , value_(default_value) {
+        MarkChanged();
+      }
+
+      Trackable(GlobalBlock* global_block, T&& default_value)
+        : TrackableBase(global_block)
+        , value_(std::move(default_value)) {
+        MarkChanged();
+      }
+
+      T Value() const { return value_; }
+
+      const T& ValueRef() const { return value_; }
+
+      template<typename P>
+      bool Assign(const T& new_value, P& policy) {
+        if (policy.Changed(value_, new_value)) {
+          value_ = new_value;
+          MarkChanged();
+          return true;
+        }
+        return false;
+      }
+
+      template<typename P>
+      bool Assign(T&& new_value, P& policy) {
+        if (policy.Changed(value_, new_value)) {
+          value_ = std::move(new_value);
+          MarkChanged();
+          return true;
+        }
+        return false;
+      }
+
+      template<typename P>
+      void SetValue(const T& new_value, P& policy) {
+        bool changed = false;
+        {
+          std::unique_lock<std::shared_timed_mutex> lock = global_block_->LockExclusive();
+          changed = Assign(new_value, policy);
+        }
+        if (changed) {
+          Publish();
+        }
+      }
+
+      template<typename P>
+      void SetValue(T&& new_value, P& policy) {
+        bool changed = false;
+        {
+          std::unique_lock<std::shared_timed_mutex> lock = global_block_->LockExclusive();
+          changed = Assign(std::move(new_value), policy);
+        }
+        if (changed) {
+          Publish();
+        }
+      }
+
+      // modifier changes the value in place and returns whether it did change it.
+      template<typename F>
+      void Modify(F&& modifier) {
+        bool changed = false;
+        {
+          std::unique_lock<std::shared_timed_mutex> lock = global_block_->LockExclusive();
+          changed = ModifyUnpublished(std::forward<F>(modifier));
+        }
+        if (changed) {
+          Publish();
+        }
+      }
+
+      // Modify without invalidating the watchers, the caller holds the exclusive lock and
+      // publishes afterwards.
+      template<typename F>
+      bool ModifyUnpublished(F&& modifier) {
+        if (!modifier(value_)) {
+          return false;
+        }
+        MarkChanged();
+        return true;
+      }
+
+    private:
+      static VersionBase* CopyVersion(const TrackableBase* value, uint64_t epoch) {
+        return new Version<T>(epoch, PublishedCopy(static_cast<const Trackable*>(value)->value_));
+      }
+
+      void MarkChanged() {
+        if (global_block_->SnapshotsEnabled()) {
+          global_block_->MarkUnpublished(this, &Trackable::CopyVersion);
+        }
+      }
+
+      T value_;
+    };
+
+    // An input which is not watched reads as a default constructed value.
+    template<typename T>
+    const T& InputRef(const NodeRef<Trackable<T>>& input) {
+      static const T empty = T();
+      return input ? input->ValueRef() : empty;
+    }
+
+    // The value published at or before epoch, a value published later reads as default constructed.
+    template<typename T>
+    const T& VersionRef(const Trackable<T>& value, uint64_t epoch) {
+      static const T empty = T();
+      const VersionBase* version = value.VersionAt(epoch);
+      return version ? static_cast<const Version<T>*>(version)->value : empty;
+    }
+
+    // Results with a copy of the inputs they were calculated from, at most capacity of them. The
+    // hash of the inputs only picks the bucket, a result is taken when every input compares equal
+    // by operator!=. A full cache evicts with CLOCK: the hand passes over the results hit since it
+    // last came by, clearing their mark, and replaces the first unmarked one.
+    template<typename T, typename... N>
+    class MemoCache {
+    public:
+      explicit MemoCache(size_t capacity)
+        : entries_()
+        , index_()
+        , hand_(0)
+        , capacity_(capacity)
+        , statistics_() {
+        entries_.reserve(capacity);
+        index_.reserve(capacity);
+      }
+
+      const T* Find(size_t hash, const N&... inputs) {
+        std::pair<Index::const_iterator, Index::const_iterator> bucket = index_.equal_range(hash);
+        for (Index::const_iterator found = bucket.first; found != bucket.second; ++found) {
+          if (Same(entries_[found->second].inputs, std::index_sequence_for<N...>{}, inputs...)) {
+            ++statistics_.hits;
+            entries_[found->second].referenced = true;
+            return &entries_[found->second].value;
+          }
+        }
+        ++statistics_.misses;
+        return nullptr;
+      }
+
+      void Insert(size_t hash, const T& value, const N&... inputs) {
+        if (entries_.size() < capacity_) {
+          index_.emplace(hash, entries_.size());
+          entries_.push_back(Entry{ hash, std::tuple<N...>(inputs...), value, false });
+          return;
+        }
+        while (entries_[hand_].referenced) {
+          entries_[hand_].referenced = false;
+          hand_ = (hand_ + 1) % capacity_;
+        }
+        std::pair<Index::iterator, Index::iterator> bucket = index_.equal_range(entries_[hand_].hash);
+        index_.erase(std::find_if(bucket.first, bucket.second, [this] (const std::pair<const size_t, size_t>& slot) { return slot.second == hand_; }));
+        entries_[hand_].hash = hash;
+        entries_[hand_].inputs = std::tuple<N...>(inputs...);
+        entries_[hand_].value = value;
+        index_.emplace(hash, hand_);
+        hand_ = (hand_ + 1) % capacity_;
+        ++statistics_.evictions;
+      }
+
+      const MemoStatistics& Statistics() const { return statistics_; }
+
+    private:
+      typedef std::unordered_multimap<size_t, size_t> Index;
+
+      struct Entry {
+        size_t hash;
+        std::tuple<N...> inputs;
+        T value;
+        bool referenced;
+      };
+
+      template<size_t... I>
+      static bool Same(const std::tuple<N...>& kept, std::index_sequence<I...>, const N&... inputs) {
+        InequalityCompare compare;
+        bool changed[] = { false, compare.Changed(std::get<I>(kept), inputs)... };
+        return std::find(std::begin(changed), std::end(changed), true) == std::end(changed);
+      }
+
+      std::vector<Entry> entries_;
+      Index index_;
+      size_t hand_;
+      size_t capacity_;
+      MemoStatistics statistics_;
+    };
+
+    // Collects the values read on this thread while an auto tracker calculates. Captures nest, a
+    // tracker updated from inside a calculator records into its own capture meanwhile.
+    class ReadCapture {
+    public:
+      explicit ReadCapture(std::vector<TrackableBase*>* reads)
+        : previous_(Current()) {
+        Current() = reads;
+      }
+
+      ~ReadCapture() {
+        Current() = previous_;
+      }
+
+      ReadCapture(const ReadCapture&) = delete;
+
+      ReadCapture& operator=(const ReadCapture&) = delete;
+
+      static void Record(TrackableBase* value) {
+        std::vector<TrackableBase*>* reads = Current();
+        if (reads && (reads->empty() || reads->back() != value)) {
+          reads->push_back(value);
+        }
+      }
+
+    private:
+      static std::vector<TrackableBase*>*& Current() {
+        static thread_local std::vector<TrackableBase*>* reads = nullptr;
+        return reads;
+      }
+
+      std::vector<TrackableBase*>* previous_;
+    };
+
+    // The calculator is not part of the type, a CalculatorTracker stores it and hands the tracker
+    // a plain function to call it through.
+    template<typename T, typename... N>
+    class Tracker : public Node {
+    public:
+      typedef T (*CalculateFunction)(void* calculator, const N&... inputs);
+      typedef bool (*MemoizedEvaluate)(Tracker* tracker);
+
+      Tracker(
+        GlobalBlock* global_block,
+        CalculateFunction calculate,
+        void* calculator
+      )
+        : tracked_value_(MakeNode<Trackable<T>>(global_block->Nodes(), global_block))
+        , global_block_(global_block)
+        , position_(Hooks(), this)
+        , tracking_values_()
+        , calculate_(calculate)
+        , calculator_(calculator)
+        , bind_function_()
+        , policy_()
+        , memo_()
+        , evaluate_memoized_(nullptr) {
+        std::unique_lock<std::shared_timed_mutex> lock = global_block_->LockExclusive();
+        global_block_->AllocatePosition(&position_, tracked_value_.get());
+        tracked_value_->SetSource(&position_);
+      }
+
+      Tracker(
+        GlobalBlock* global_block,
+        const T& default_value,
+        CalculateFunction calculate,
+        void* calculator
+      )
+        : tracked_value_(MakeNode<Trackable<T>>(global_block->Nodes(), global_block, default_value))
+        , global_block_(global_block)
+        , position_(Hooks(), this)
+        , tracking_values_()
+        , calculate_(calculate)
+        , calculator_(calculator)
+        , bind_function_()
+        , policy_()
+        , memo_()
+        , evaluate_memoized_(nullptr) {
+        std::unique_lock<std::shared_timed_mutex> lock = global_block_->LockExclusive();
+        global_block_->AllocatePosition(&position_, tracked_value_.get());
+        tracked_value_->SetSource(&position_);
+      }
+
+      Tracker(const Tracker&) = delete;
+
+      Tracker& operator=(const Tracker&) = delete;
+
+      // DTracker holds the exclusive lock while the last reference goes.
+      ~Tracker() {
+        StopTrackInputs(std::index_sequence_for<N...>{});
+        tracked_value_->SetSource(nullptr);
+        global_block_->FreePosition(&position_);
+        tracked_value_.reset();
+      }
+
+      bool IsValid() const {
+        return global_block_->IsPositionValid(position_.Position());
+      }
+
+      template<size_t index>
+      void Watch(const NodeRef<Trackable<std::tuple_element_t<index, std::tuple<N...>>>>& value) {
+        ReleaseInput<index>();
+        std::get<index>(tracking_values_) = value;
+        value->Track(position_.Position());
+        if (value->Source()) {
+          global_block_->RaiseHeight(position_.Position(), global_block_->Height(value->Source()->Position()) + 1);
+        }
+        global_block_->CommitInvalidatedPosition(position_.Position());
+      }
+
+      void Update() {
+        RefreshInputs(std::index_sequence_for<N...>{});
+        bool recompute = global_block_->HasChangedInputs(position_.Position());
+        if (recompute && Evaluate()) {
+          tracked_value_->Invalidate();
+        }
+        global_block_->CommitValidatedTracker(&position_);
+        global_block_->CountUpdate(recompute);
+      }
+
+      // Reads the inputs as they are, Update and the drain refresh them first.
+      bool Evaluate() {
+        if (memo_) {
+          return evaluate_memoized_(this);
+        }
+        return tracked_value_->Assign(Calculate(std::index_sequence_for<N...>{}), policy_);
+      }
+
+      // Inputs are hashed with Hash, std::hash<N> when it is void. A capacity of 0 stops memoizing.
+      template<typename Hash>
+      void Memoize(size_t capacity) {
+        if (!capacity) {
+          memo_.reset();
+          evaluate_memoized_ = nullptr;
+          return;
+        }
+        memo_.reset(new MemoCache<T, N...>(capacity));
+        evaluate_memoized_ = &Tracker::EvaluateMemoized<Hash>;
+      }
+
+      MemoStatistics CacheStatistics() const {
+        return memo_ ? memo_->Statistics() : MemoStatistics();
+      }
+
+      const NodeRef<Trackable<T>>& TrackedValue() const { return tracked_value_; }
+
+      GlobalBlock* Block() const { return global_block_; }
+
+      void Bind(const std::function<void (const T&)>& bind_function) {
+        bind_function_ = bind_function;
+      }
+
+      void Apply() {
+        if (bind_function_) {
+          bind_function_(tracked_value_->ValueRef());
+        }
+      }
+
+      T Value() {
+        if (!IsValid()) {
+          Update();
+        }
+        return tracked_value_->Value();
+      }
+
+      // Brings the value up to date first, which is why it is not const.
+      const T& ValueRef() {
+        if (!IsValid()) {
+          Update();
+        }
+        return tracked_value_->ValueRef();
+      }
+
+    private:
+      static const TrackerHooks* Hooks() {
+        static const TrackerHooks hooks = {
+          [] (void* tracker) { static_cast<Tracker*>(tracker)->Apply(); },
+          [] (void* tracker) { static_cast<Tracker*>(tracker)->Update(); },
+          [] (void* tracker) { static_cast<Tracker*>(tracker)->RefreshInputs(std::index_sequence_for<N...>{}); },
+          [] (void* tracker) { return static_cast<Tracker*>(tracker)->Evaluate(); },
+          [] (void* tracker) { return static_cast<Tracker*>(tracker)->InputsValid(std::index_sequence_for<N...>{}); },
+          false
+        };
+        return &hooks;
+      }
+
+      template<size_t... I>
+      T Calculate(std::index_sequence<I...>) {
+        return calculate_(calculator_, InputRef(std::get<I>(tracking_values_))...);
+      }
+
+      // Only memoizing trackers need inputs which hash and compare.
+      template<typename Hash>
+      static bool EvaluateMemoized(Tracker* tracker) {
+        return tracker->EvaluateMemoized<Hash>(std::index_sequence_for<N...>{});
+      }
+
+      template<typename Hash, size_t... I>
+      bool EvaluateMemoized(std::index_sequence<I...>) {
+        size_t hash = HashInputs<Hash>(tracking_values_, std::index_sequence_for<N...>{});
+        const T* cached = memo_->Find(hash, InputRef(std::get<I>(tracking_values_))...);
+        if (cached) {
+          return tracked_value_->Assign(*cached, policy_);
+        }
+        T value = Calculate(std::index_sequence_for<N...>{});
+        memo_->Insert(hash, value, InputRef(std::get<I>(tracking_values_))...);
+        return tracked_value_->Assign(std::move(value), policy_);
+      }
+
+      template<typename Hash, size_t... I>
+      static size_t HashInputs(const std::tuple<NodeRef<Trackable<N>>...>& inputs, std::index_sequence<I...>) {
+        size_t seed = 0;
+        int hashed[] = { 0, (seed = CombineHash(seed, HashInput<Hash>(InputRef(std::get<I>(inputs)))), 0)... };
+        (void)hashed;
+        return seed;
+      }
+
+      template<typename Hash, typename V>
+      static size_t HashInput(const V& value) {
+        std::conditional_t<std::is_void<Hash>::value, std::hash<V>, Hash> hash;
+        return hash(value);
+      }
+
+      static size_t CombineHash(size_t seed, size_t hash) {
+        return seed ^ (hash + static_cast<size_t>(0x9e3779b97f4a7c15ULL) + (seed << 6) + (seed >> 2));
+      }
+
+      template<size_t... I>
+      void RefreshInputs(std::index_sequence<I...>) {
+        int refreshed[] = { 0, (std::get<I>(tracking_values_) ? std::get<I>(tracking_values_)->Refresh() : void(), 0)... };
+        (void)refreshed;
+      }
+
+      template<size_t... I>
+      bool InputsValid(std::index_sequence<I...>) const {
+        bool valid[] = { true, (!std::get<I>(tracking_values_) || std::get<I>(tracking_values_)->IsSourceValid())... };
+        return std::find(std::begin(valid), std::end(valid), false) == std::end(valid);
+      }
+
+      template<size_t... I>
+      size_t CountInput(const TrackableBase* value, std::index_sequence<I...>) const {
+        const TrackableBase* inputs[] = { nullptr, std::get<I>(tracking_values_).get()... };
+        return std::count(std::begin(inputs) + 1, std::end(inputs), value);
+      }
+
+      // Several inputs may watch the same value through the same position bit, the bit is only
+      // released together with the last of them.
+      template<size_t index>
+      void ReleaseInput() {
+        const TrackableBase* value = std::get<index>(tracking_values_).get();
+        if (value && CountInput(value, std::index_sequence_for<N...>{}) == 1) {
+          std::get<index>(tracking_values_)->StopTrack(position_.Position());
+        }
+        std::get<index>(tracking_values_).reset();
+      }
+
+      template<size_t... I>
+      void StopTrackInputs(std::index_sequence<I...>) {
+        int stopped[] = { 0, (ReleaseInput<I>(), 0)... };
+        (void)stopped;
+      }
+
+      NodeRef<Trackable<T>> tracked_value_;
+      GlobalBlock* global_block_;
+      TrackerPosition position_;
+      std::tuple<NodeRef<Trackable<N>>...> tracking_values_;
+      CalculateFunction calculate_;
+      void* calculator_;
+      std::function<void(const T&)> bind_function_;
+      typename ChangePolicy<T>::type policy_;
+      std::unique_ptr<MemoCache<T, N...>> memo_;
+      MemoizedEvaluate evaluate_memoized_;
+    };
+
+    template<typename F, typename T, typename... N>
+    class CalculatorTracker : public Tracker<T, N...> {
+    public:
+      CalculatorTracker(GlobalBlock* global_block, F calculator)
+        : Tracker<T, N...>(global_block, &CalculatorTracker::Calculate, &calculator_)
+        , calculator_(std::move(calculator)) {
+
+      }
+
+      CalculatorTracker(GlobalBlock* global_block, const T& default_value, F calculator)
+        : Tracker<T, N...>(global_block, default_value, &CalculatorTracker::Calculate, &calculator_)
+        , calculator_(std::move(calculator)) {
+
+      }
+
+    private:
+      static T Calculate(void* calculator, const N&... inputs) {
+        return (*static_cast<F*>(calculator))(inputs...);
+      }
+
+      F calculator_;
+    };
+
+    // The DTracker computing with a calculator of type F, from the parameters of its call operator.
+    template<typename F>
+    struct CalculatorTraits : CalculatorTraits<decltype(&F::operator())> {
+
+    };
+
+    template<typename R, typename... A>
+    struct CalculatorTraits<R(*)(A...)> {
+      typedef DTracker<R, std::decay_t<A>...> Tracker;
+    };
+
+    template<typename C, typename R, typename... A>
+    struct CalculatorTraits<R(C::*)(A...)> : CalculatorTraits<R(*)(A...)> {
+
+    };
+
+    template<typename C, typename R, typename... A>
+    struct CalculatorTraits<R(C::*)(A...) const> : CalculatorTraits<R(*)(A...)> {
+
+    };
+
+    // A tracker without declared inputs, it watches whatever its calculator read on the last run.
+    // Inputs which were not read again stop invalidating it.
+    template<typename T>
+    class AutoTracker : public Node {
+    public:
+      typedef T (*CalculateFunction)(void* calculator);
+
+      AutoTracker(
+        GlobalBlock* global_block,
+        CalculateFunction calculate,
+        void* calculator
+      )
+        : tracked_value_(MakeNode<Trackable<T>>(global_block->Nodes(), global_block))
+        , global_block_(global_block)
+        , position_(Hooks(), this)
+        , inputs_()
+        , reads_()
+        , capture_()
+        , rewatched_()
+        , calculate_(calculate)
+        , calculator_(calculator)
+        , bind_function_()
+        , policy_() {
+        Start();
+      }
+
+      AutoTracker(
+        GlobalBlock* global_block,
+        const T& default_value,
+        CalculateFunction calculate,
+        void* calculator
+      )
+        : tracked_value_(MakeNode<Trackable<T>>(global_block->Nodes(), global_block, default_value))
+        , global_block_(global_block)
+        , position_(Hooks(), this)
+        , inputs_()
+        , reads_()
+        , capture_()
+        , rewatched_()
+        , calculate_(calculate)
+        , calculator_(calculator)
+        , bind_function_()
+        , policy_() {
+        Start();
+      }
+
+      AutoTracker(const AutoTracker&) = delete;
+
+      AutoTracker& operator=(const AutoTracker&) = delete;
+
+      ~AutoTracker() {
+        for (size_t i = 0; i < inputs_.size(); ++i) {
+          inputs_[i]->StopTrack(position_.Position());
+        }
+        inputs_.clear();
+        tracked_value_->SetSource(nullptr);
+        global_block_->FreePosition(&position_);
+        tracked_value_.reset();
+      }
+
+      bool IsValid() const {
+        return global_block_->IsPositionValid(position_.Position());
+      }
+
+      // The inputs are refreshed in the order the last run read them, up to the first one which
+      // changed. The calculator refreshes the rest itself if it still reads them.
+      void Update() {
+        RefreshReads();
+        bool recompute = global_block_->HasChangedInputs(position_.Position());
+        if (recompute && Evaluate()) {
+          tracked_value_->Invalidate();
+        }
+        global_block_->CommitValidatedTracker(&position_);
+        global_block_->CountUpdate(recompute);
+      }
+
+      bool Evaluate() {
+        capture_.clear();
+        T value = Calculate();
+        Rewatch();
+        return tracked_value_->Assign(std::move(value), policy_);
+      }
+
+      const NodeRef<Trackable<T>>& TrackedValue() const { return tracked_value_; }
+
+      GlobalBlock* Block() const { return global_block_; }
+
+      void Bind(const std::function<void (const T&)>& bind_function) {
+        bind_function_ = bind_function;
+      }
+
+      void Apply() {
+        if (bind_function_) {
+          bind_function_(tracked_value_->ValueRef());
+        }
+      }
+
+      T Value() {
+        if (!IsValid()) {
+          Update();
+        }
+        return tracked_value_->Value();
+      }
+
+      const T& ValueRef() {
+        if (!IsValid()) {
+          Update();
+        }
+        return tracked_value_->ValueRef();
+      }
+
+    private:
+      static const TrackerHooks* Hooks() {
+        static const TrackerHooks hooks = {
+          [] (void* tracker) { static_cast<AutoTracker*>(tracker)->Apply(); },
+          [] (void* tracker) { static_cast<AutoTracker*>(tracker)->Update(); },
+          [] (void* tracker) { static_cast<AutoTracker*>(tracker)->RefreshReads(); },
+          [] (void* tracker) { return static_cast<AutoTracker*>(tracker)->Evaluate(); },
+          [] (void* tracker) { return static_cast<AutoTracker*>(tracker)->InputsValid(); },
+          true
+        };
+        return &hooks;
+      }
+
+      void RefreshReads() {
+        for (size_t i = 0; i < reads_.size() && !global_block_->HasChangedInputs(position_.Position()); ++i) {
+          reads_[i]->Refresh();
+        }
+      }
+
+      bool InputsValid() const {
+        for (size_t i = 0; i < reads_.size(); ++i) {
+          if (!reads_[i]->IsSourceValid()) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      // Starts invalid, the first read calculates.
+      void Start() {
+        assert(!global_block_->Concurrent() && "auto trackers need a single threaded graph");
+        global_block_->AllocatePosition(&position_, tracked_value_.get());
+        tracked_value_->SetSource(&position_);
+        global_block_->CommitInvalidatedPosition(position_.Position());
+      }
+
+      T Calculate() {
+        ReadCapture capture(&capture_);
+        return calculate_(calculator_);
+      }
+
+      // Both lists are sorted by address, the values read by this run which were not read by the
+      // last one start being watched and those which were not read again are dropped.
+      void Rewatch() {
+        reads_.swap(capture_);
+        capture_.assign(reads_.begin(), reads_.end());
+        std::sort(capture_.begin(), capture_.end());
+        capture_.erase(std::unique(capture_.begin(), capture_.end()), capture_.end());
+        rewatched_.reserve(capture_.size());
+        size_t kept = 0;
+        for (size_t i = 0; i < capture_.size(); ++i) {
+          assert(capture_[i]->Block() == global_block_ && "auto trackers read values of their own graph");
+          for (; kept < inputs_.size() && inputs_[kept].get() < capture_[i]; ++kept) {
+            inputs_[kept]->StopTrack(position_.Position());
+          }
+          if (kept < inputs_.size() && inputs_[kept].get() == capture_[i]) {
+            rewatched_.push_back(std::move(inputs_[kept++]));
+            continue;
+          }
+          capture_[i]->Track(position_.Position());
+          if (capture_[i]->Source()) {
+            global_block_->RaiseHeight(position_.Position(), global_block_->Height(capture_[i]->Source()->Position()) + 1);
+          }
+          rewatched_.push_back(NodeRef<TrackableBase>(capture_[i]));
+        }
+        for (; kept < inputs_.size(); ++kept) {
+          inputs_[kept]->StopTrack(position_.Position());
+        }
+        inputs_.swap(rewatched_);
+        rewatched_.clear();
+        capture_.clear();
+      }
+
+      NodeRef<Trackable<T>> tracked_value_;
+      GlobalBlock* global_block_;
+      TrackerPosition position_;
+      // Every value read by the last run, sorted by address.
+      std::vector<NodeRef<TrackableBase>> inputs_;
+      // The same values in the order they were read, kept alive by inputs_.
+      std::vector<TrackableBase*> reads_;
+      std::vector<TrackableBase*> capture_;
+      std::vector<NodeRef<TrackableBase>> rewatched_;
+      CalculateFunction calculate_;
+      void* calculator_;
+      std::function<void(const T&)> bind_function_;
+      typename ChangePolicy<T>::type policy_;
+    };
+
+    template<typename F, typename T>
+    class AutoCalculatorTracker : public AutoTracker<T> {
+    public:
+      AutoCalculatorTracker(GlobalBlock* global_block, F calculator)
+        : AutoTracker<T>(global_block, &AutoCalculatorTracker::Calculate, &calculator_)
+        , calculator_(std::move(calculator)) {
+
+      }
+
+      AutoCalculatorTracker(GlobalBlock* global_block, const T& default_value, F calculator)
+        : AutoTracker<T>(global_block, default_value, &AutoCalculatorTracker::Calculate, &calculator_)
+        , calculator_(std::move(calculator)) {
+
+      }
+
+    private:
+      static T Calculate(void* calculator) {
+        return (*static_cast<F*>(calculator))();
+      }
+
+      F calculator_;
+    };
+
+    inline std::tuple<size_t, uintptr_t> PositionAllocator::Allocate() {
+      const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+      if (levels_.empty()) {
+        levels_.emplace_back(1, 0);
+      }
+      size_t level = levels_.size() - 1;
+      size_t index = 0;
+      size_t word = 0;
+      uintptr_t bit = 1;
+      while (true) {
+        if (
+          index == levels_[level].size()
+          ||
+          levels_[level][index] == std::numeric_limits<uintptr_t>::max()
+        ) {
+          word = Grow();
+          bit = 1;
+          break;
+        }
+        int free_bit = bitops::CountTrailingZeros(static_cast<uintptr_t>(~levels_[level][index]));
+        if (level == 0) {
+          word = index;
+          bit = static_cast<uintptr_t>(1) << free_bit;
+          break;
+        }
+        index = index * bits + free_bit;
+        --level;
+      }
+      levels_[0][word] = levels_[0][word] | bit;
+      index = word;
+      for (
+        level = 0;
+        level + 1 < levels_.size() && levels_[level][index] == std::numeric_limits<uintptr_t>::max();
+        ++level
+      ) {
+        levels_[level + 1][index / bits] = levels_[level + 1][index / bits] | (static_cast<uintptr_t>(1) << (index % bits));
+        index = index / bits;
+      }
+      return std::make_tuple(word, bit);
+    }
+
+    inline void PositionAllocator::Free(const std::tuple<size_t, uintptr_t>& position) {
+      const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+      assert(CheckBit(std::get<1>(position)));
+      assert(Occupied(std::get<0>(position)) & std::get<1>(position));
+      size_t index = std::get<0>(position);
+      bool was_full = levels_[0][index] == std::numeric_limits<uintptr_t>::max();
+      levels_[0][index] = levels_[0][index] & (~std::get<1>(position));
+      for (size_t level = 1; was_full && level < levels_.size(); ++level) {
+        uintptr_t& summary = levels_[level][index / bits];
+        was_full = summary == std::numeric_limits<uintptr_t>::max();
+        summary = summary & (~(static_cast<uintptr_t>(1) << (index % bits)));
+        index = index / bits;
+      }
+    }
+
+    inline size_t PositionAllocator::Grow() {
+      const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+      size_t word = levels_[0].size();
+      levels_[0].push_back(0);
+      size_t index = word;
+      for (size_t level = 1; level < levels_.size(); ++level) {
+        index = index / bits;
+        if (index == levels_[level].size()) {
+          levels_[level].push_back(0);
+        }
+      }
+      if (levels_.back().size() > 1) {
+        uintptr_t summary = 0;
+        for (size_t i = 0; i < levels_.back().size(); ++i) {
+          if (levels_.back()[i] == std::numeric_limits<uintptr_t>::max()) {
+            summary = summary | (static_cast<uintptr_t>(1) << i);
+          }
+        }
+        levels_.emplace_back(1, summary);
+      }
+      return word;
+    }
+
+    inline void GlobalBlock::AllocatePosition(TrackerPosition* tracker_position, const TrackableBase* output) {
+      std::tuple<size_t, uintptr_t> position_allocated = positions_.Allocate();
+      size_t slot = Slot(position_allocated);
+      if (trackers_.size() <= slot) {
+        size_t words = std::get<0>(position_allocated) + 1;
+        trackers_validation_status_.Grow(words);
+        trackers_changed_inputs_.Grow(words);
+        trackers_.resize(words * sizeof(uintptr_t) * CHAR_BIT, nullptr);
+        trackers_output_.resize(trackers_.size(), nullptr);
+        trackers_height_.resize(trackers_.size(), 0);
+        trackers_generation_.resize(trackers_.size(), 0);
+        trackers_queued_.resize(trackers_.size(), 0);
+      }
+      tracker_position->position_ = position_allocated;
+      tracker_position->generation_ = trackers_generation_[slot];
+      trackers_[slot] = tracker_position;
+      trackers_output_[slot] = output;
+      trackers_height_[slot] = 0;
+    }
+
+    inline void GlobalBlock::FreePosition(const TrackerPosition* tracker) {
+      std::tuple<size_t, uintptr_t> position = tracker->Position();
+      size_t slot = Slot(position);
+      assert(trackers_[slot] == tracker && trackers_generation_[slot] == tracker->Generation());
+      positions_.Free(position);
+      trackers_validation_status_.Clear(std::get<0>(position), std::get<1>(position));
+      trackers_changed_inputs_.Clear(std::get<0>(position), std::get<1>(position));
+      trackers_[slot] = nullptr;
+      trackers_output_[slot] = nullptr;
+      ++trackers_generation_[slot];
+    }
+
+    inline void GlobalBlock::Apply() {
+      if (mode_ == UpdateMode::Pull) {
+        std::shared_lock<std::shared_timed_mutex> lock = LockShared();
+        ForEachInvalidTracker(
+          [this] (size_t slot) {
+            Enqueue(slot);
+          }
+        );
+      }
+      Drain();
+      if (mode_ == UpdateMode::Pull && !draining_) {
+        drains_.fetch_add(1, std::memory_order_relaxed);
+      }
+      PublishEpoch();
+    }
+
+    inline void GlobalBlock::Enqueue(size_t slot) {
+      if (trackers_queued_[slot]) {
+        return;
+      }
+      trackers_queued_[slot] = 1;
+      size_t height = trackers_height_[slot];
+      if (height >= apply_levels_.size()) {
+        apply_levels_.resize(height + 1);
+      }
+      apply_levels_[height].push_back(slot);
+      lowest_queued_ = std::min(lowest_queued_, height);
+    }
+
+    // Recalculates every queued tracker exactly once, lower heights first so each tracker sees
+    // up to date inputs, then hands the new values of a height to the bound callbacks. Trackers
+    // of the same height only read lower heights, so with a pool they are evaluated in parallel
+    // and their results are committed once the whole height is done. The callbacks of the trackers
+    // whose value changed run after the commit and may write values again. In push mode that
+    // queues trackers at any height, which this drain recalculates as well; in pull mode the
+    // watchers of the written values stay invalid until they are read or applied again.
+    inline void GlobalBlock::Drain() {
+      if (draining_) {
+        return;
+      }
+      draining_ = true;
+      while (lowest_queued_ < apply_levels_.size()) {
+        size_t height = lowest_queued_;
+        if (apply_levels_[height].empty()) {
+          ++lowest_queued_;
+          continue;
+        }
+        std::vector<size_t> level;
+        level.swap(apply_levels_[height]);
+        std::shared_lock<std::shared_timed_mutex> lock = LockShared();
+        // Trackers read since they were queued are valid already, trackers which gained height
+        // wait for their new inputs.
+        size_t kept = 0;
+        for (size_t i = 0; i < level.size(); ++i) {
+          size_t slot = level[i];
+          trackers_queued_[slot] = 0;
+          if (!trackers_[slot] || IsPositionValid(SlotPosition(slot))) {
+            continue;
+          }
+          if (trackers_height_[slot] != height) {
+            Enqueue(slot);
+            continue;
+          }
+          // Callbacks writing in pull mode leave lower trackers invalid, those are updated here on
+          // the draining thread rather than by the workers evaluating this level.
+          trackers_[slot]->Refresh();
+          if (!HasChangedInputs(SlotPosition(slot))) {
+            CommitValidatedTracker(trackers_[slot]);
+            CountUpdate(false);
+            continue;
+          }
+          level[kept++] = slot;
+        }
+        statistics_.recomputations += kept;
+        level.resize(kept);
+        // Slot order keeps the registry vectors streaming. The scan of Apply queues in slot order,
+        // invalidation in push mode does not.
+        if (!std::is_sorted(level.begin(), level.end())) {
+          std::sort(level.begin(), level.end());
+        }
+        apply_changed_.assign(level.size(), 0);
+        if (pool_ && level.size() > 1) {
+          pool_->Run(
+            level.size(),
+            [this, &level] (size_t i) {
+              if (!trackers_[level[i]]->Serial()) {
+                apply_changed_[i] = trackers_[level[i]]->Evaluate();
+              }
+            }
+          );
+          for (size_t i = 0; i < level.size(); ++i) {
+            if (trackers_[level[i]]->Serial()) {
+              apply_changed_[i] = trackers_[level[i]]->Evaluate();
+            }
+          }
+        } else {
+          for (size_t i = 0; i < level.size(); ++i) {
+            apply_changed_[i] = trackers_[level[i]]->Evaluate();
+          }
+        }
+        apply_generations_.resize(level.size());
+        for (size_t i = 0; i < level.size(); ++i) {
+          if (apply_changed_[i]) {
+            CommitInvalidatedPositions(trackers_output_[level[i]]->TrackedPositions());
+          }
+          CommitValidatedTracker(trackers_[level[i]]);
+          apply_generations_[i] = trackers_generation_[level[i]];
+        }
+        // Callbacks may write values, which takes the lock exclusively, and may destroy trackers
+        // of this level or create new ones in their slots.
+        if (lock) {
+          lock.unlock();
+        }
+        for (size_t i = 0; i < level.size(); ++i) {
+          TrackerPosition* tracker = apply_changed_[i] ? TrackerAt(level[i], apply_generations_[i]) : nullptr;
+          if (tracker) {
+            tracker->NotifyApply();
+          }
+        }
+        // Hands the buffer back unless the callbacks queued more trackers of this height.
+        level.clear();
+        if (apply_levels_[height].empty()) {
+          level.swap(apply_levels_[height]);
+        }
+      }
+      lowest_queued_ = std::numeric_limits<size_t>::max();
+      draining_ = false;
+      if (mode_ == UpdateMode::Push) {
+        drains_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    inline void GlobalBlock::SetUpdateMode(UpdateMode mode) {
+      assert((!concurrent_ || mode == UpdateMode::Pull) && "concurrent graphs stay in pull mode");
+      mode_ = mode;
+      if (mode_ == UpdateMode::Push) {
+        // Trackers invalidated in pull mode were not queued.
+        {
+          std::shared_lock<std::shared_timed_mutex> lock = LockShared();
+          ForEachInvalidTracker(
+            [this] (size_t slot) {
+              Enqueue(slot);
+            }
+          );
+        }
+        Apply();
+        return;
+      }
+      for (size_t height = 0; height < apply_levels_.size(); ++height) {
+        for (size_t i = 0; i < apply_levels_[height].size(); ++i) {
+          trackers_queued_[apply_levels_[height][i]] = 0;
+        }
+        apply_levels_[height].clear();
+      }
+      lowest_queued_ = std::numeric_limits<size_t>::max();
+    }
+
+    inline void GlobalBlock::SetWorkerCount(size_t worker_count) {
+      if (worker_count <= 1) {
+        pool_.reset();
+        return;
+      }
+      if (!pool_ || pool_->WorkerCount() != worker_count) {
+        pool_.reset(new WorkStealingPool(worker_count));
+      }
+    }
+
+    inline void GlobalBlock::CommitValidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position) {
+      assert(CheckBit(std::get<1>(tracker_position)));
+      if (std::get<0>(tracker_position) >= trackers_validation_status_.Size()) {
+        return;
+      }
+      trackers_validation_status_.Clear(std::get<0>(tracker_position), std::get<1>(tracker_position));
+      trackers_changed_inputs_.Clear(std::get<0>(tracker_position), std::get<1>(tracker_position));
+    }
+
+    // Writers of a concurrent graph propagate under the shared lock while readers evaluate. One
+    // which reached the tracker during its evaluation found it invalid and stopped there, while
+    // the inputs it invalidated before may already have been read. The inputs are checked once
+    // the bit is cleared, either the writer's propagation saw the cleared bit or the check sees
+    // the inputs it invalidated.
+    inline void GlobalBlock::CommitValidatedTracker(TrackerPosition* tracker) {
+      CommitValidatedPosition(tracker->Position());
+      if (concurrent_ && !tracker->InputsValid()) {
+        std::vector<std::tuple<size_t, uintptr_t>>& queue = PropagationQueue();
+        queue.push_back(tracker->Position());
+        PropagateInvalidation(queue);
+      }
+    }
+
+    // The positions given to the commits have changed inputs, the trackers downstream of them are
+    // only invalidated.
+    inline void GlobalBlock::CommitInvalidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position) {
+      assert(CheckBit(std::get<1>(tracker_position)));
+      trackers_changed_inputs_.Set(std::get<0>(tracker_position), std::get<1>(tracker_position));
+      std::vector<std::tuple<size_t, uintptr_t>>& queue = PropagationQueue();
+      queue.push_back(tracker_position);
+      PropagateInvalidation(queue);
+    }
+
+    inline void GlobalBlock::CommitInvalidatedPositions(const TrackedPositionSet& tracker_positions) {
+      const std::tuple<size_t, uintptr_t>* it = tracker_positions.begin();
+      for (; it != tracker_positions.end(); ++it) {
+        trackers_changed_inputs_.Set(std::get<0>(*it), std::get<1>(*it));
+      }
+      std::vector<std::tuple<size_t, uintptr_t>>& queue = PropagationQueue();
+      queue.insert(queue.end(), tracker_positions.begin(), tracker_positions.end());
+      PropagateInvalidation(queue);
+    }
+
+    inline void GlobalBlock::EndTransaction() {
+      assert(transaction_depth_ > 0);
+      if (--transaction_depth_ > 0) {
+        return;
+      }
+      transaction_seeds_.resize(trackers_validation_status_.Size(), 0);
+      for (size_t i = 0; i < deferred_values_.size(); ++i) {
+        deferred_values_[i]->ClearDeferred();
+        const TrackedPositionSet& watchers = deferred_values_[i]->TrackedPositions();
+        const std::tuple<size_t, uintptr_t>* it = watchers.begin();
+        for (; it != watchers.end(); ++it) {
+          if (!transaction_seeds_[std::get<0>(*it)]) {
+            transaction_words_.push_back(std::get<0>(*it));
+          }
+          transaction_seeds_[std::get<0>(*it)] = transaction_seeds_[std::get<0>(*it)] | std::get<1>(*it);
+        }
+      }
+      deferred_values_.clear();
+      std::vector<std::tuple<size_t, uintptr_t>>& queue = PropagationQueue();
+      for (size_t i = 0; i < transaction_words_.size(); ++i) {
+        size_t word = transaction_words_[i];
+        trackers_changed_inputs_.Set(word, transaction_seeds_[word]);
+        queue.emplace_back(word, transaction_seeds_[word]);
+        transaction_seeds_[word] = 0;
+      }
+      transaction_words_.clear();
+      PropagateInvalidation(queue);
+      Drain();
+    }
+
+    inline GlobalBlock::~GlobalBlock() {
+      for (size_t i = 0; i < retired_versions_.size(); ++i) {
+        retired_versions_[i]->destroy(retired_versions_[i]);
+      }
+    }
+
+    inline void GlobalBlock::MarkUnpublished(TrackableBase* value, VersionBase* (*copy)(const TrackableBase* value, uint64_t epoch)) {
+      std::lock_guard<std::mutex> lock(unpublished_mutex_);
+      if (value->unpublished_) {
+        return;
+      }
+      value->unpublished_ = true;
+      UnpublishedValue unpublished = { NodeRef<TrackableBase>(value), copy };
+      unpublished_.push_back(std::move(unpublished));
+    }
+
+    // Values are copied under the shared lock, writers of a concurrent graph change them only
+    // under the exclusive one. The references dropped here may be the last ones.
+    inline void GlobalBlock::PublishEpoch() {
+      // An Apply from a callback would publish a graph halfway through its drain.
+      if (!snapshots_ || draining_) {
+        return;
+      }
+      std::shared_lock<std::shared_timed_mutex> lock = LockShared();
+      {
+        std::lock_guard<std::mutex> unpublished_lock(unpublished_mutex_);
+        publishing_.swap(unpublished_);
+        for (size_t i = 0; i < publishing_.size(); ++i) {
+          publishing_[i].value->unpublished_ = false;
+        }
+      }
+      uint64_t epoch = epoch_.load(std::memory_order_relaxed) + 1;
+      for (size_t i = 0; i < publishing_.size(); ++i) {
+        TrackableBase* value = publishing_[i].value.get();
+        bool replaces = value->versions_.load(std::memory_order_relaxed) != nullptr;
+        value->PushVersion(publishing_[i].copy(value, epoch));
+        if (replaces && !value->trimmable_) {
+          value->trimmable_ = true;
+          trimmable_.push_back(publishing_[i].value);
+        }
+      }
+      publishing_.clear();
+      // A reader pinning the old epoch either shows up in the scan or sees the new epoch and
+      // pins that one instead.
+      epoch_.store(epoch, std::memory_order_seq_cst);
+      pinned_epochs_.clear();
+      for (size_t i = 0; i < kReaderSlots; ++i) {
+        uint64_t pinned = reader_epochs_[i].load(std::memory_order_seq_cst);
+        if (pinned) {
+          pinned_epochs_.push_back(pinned);
+        }
+      }
+      std::sort(pinned_epochs_.begin(), pinned_epochs_.end());
+      size_t kept = 0;
+      for (size_t i = 0; i < trimmable_.size(); ++i) {
+        if (trimmable_[i]->TrimVersions(pinned_epochs_, retired_versions_)) {
+          trimmable_[kept++] = std::move(trimmable_[i]);
+        } else {
+          trimmable_[i]->trimmable_ = false;
+        }
+      }
+      trimmable_.resize(kept);
+      retired_epochs_.resize(retired_versions_.size(), epoch);
+      // Readers walking through a retired version were pinned before it was retired.
+      uint64_t oldest_pinned = pinned_epochs_.empty() ? epoch : pinned_epochs_.front();
+      kept = 0;
+      for (size_t i = 0; i < retired_versions_.size(); ++i) {
+        if (retired_epochs_[i] <= oldest_pinned) {
+          retired_versions_[i]->destroy(retired_versions_[i]);
+        } else {
+          retired_versions_[kept] = retired_versions_[i];
+          retired_epochs_[kept++] = retired_epochs_[i];
+        }
+      }
+      retired_versions_.resize(kept);
+      retired_epochs_.resize(kept);
+    }
+
+    inline size_t GlobalBlock::PinEpoch(uint64_t& epoch) {
+      while (true) {
+        for (size_t slot = 0; slot < kReaderSlots; ++slot) {
+          uint64_t free_slot = 0;
+          epoch = epoch_.load(std::memory_order_seq_cst);
+          if (!reader_epochs_[slot].compare_exchange_strong(free_slot, epoch, std::memory_order_seq_cst)) {
+            continue;
+          }
+          // Versions of an epoch replaced meanwhile may be gone, the latest one is pinned instead.
+          for (uint64_t latest = epoch_.load(std::memory_order_seq_cst); latest != epoch; latest = epoch_.load(std::memory_order_seq_cst)) {
+            epoch = latest;
+            reader_epochs_[slot].store(epoch, std::memory_order_seq_cst);
+          }
+          return slot;
+        }
+        // A slot unpinned after the check sees the waiter and notifies under the mutex.
+        std::unique_lock<std::mutex> lock(reader_slots_mutex_);
+        reader_waiters_.fetch_add(1, std::memory_order_seq_cst);
+        reader_slot_freed_.wait(
+          lock,
+          [this] () {
+            for (size_t slot = 0; slot < kReaderSlots; ++slot) {
+              if (!reader_epochs_[slot].load(std::memory_order_seq_cst)) {
+                return true;
+              }
+            }
+            return false;
+          }
+        );
+        reader_waiters_.fetch_sub(1, std::memory_order_seq_cst);
+      }
+    }
+
+    inline bool GlobalBlock::IsPositionValid(const std::tuple<size_t, uintptr_t>& tracker_position) const {
+      assert(CheckBit(std::get<1>(tracker_position)));
+      if (std::get<0>(tracker_position) >= trackers_validation_status_.Size()) {
+        return true;
+      }
+      return !(trackers_validation_status_.Load(std::get<0>(tracker_position)) & std::get<1>(tracker_position));
+    }
+
+    inline void GlobalBlock::RaiseHeight(const std::tuple<size_t, uintptr_t>& tracker_position, size_t height) {
+      size_t slot = Slot(tracker_position);
+      if (trackers_height_[slot] >= height) {
+        return;
+      }
+      trackers_height_[slot] = height;
+      std::vector<size_t> raised(1, slot);
+      while (!raised.empty()) {
+        size_t current = raised.back();
+        raised.pop_back();
+        const TrackedPositionSet& downstream = trackers_output_[current]->TrackedPositions();
+        const std::tuple<size_t, uintptr_t>* it = downstream.begin();
+        for (; it != downstream.end(); ++it) {
+          uintptr_t bits = std::get<1>(*it);
+          while (bits) {
+            size_t watcher = Slot(std::make_tuple(std::get<0>(*it), bits & (~bits + 1)));
+            bits = bits & (bits - 1);
+            if (trackers_height_[watcher] <= trackers_height_[current]) {
+              trackers_height_[watcher] = trackers_height_[current] + 1;
+              raised.push_back(watcher);
+            }
+          }
+        }
+      }
+    }
+
+    // Marks the queued positions and every tracker downstream of them invalid. A tracker which is already
+    // invalid is not walked again, its whole cone has been marked when it became invalid. Setting
+    // the bits tells which of them were valid, so of several threads invalidating the same tracker
+    // only one walks its cone.
+    inline void GlobalBlock::PropagateInvalidation(std::vector<std::tuple<size_t, uintptr_t>>& queue) {
+      const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+      while (!queue.empty()) {
+        std::tuple<size_t, uintptr_t> positions = queue.back();
+        queue.pop_back();
+        size_t word = std::get<0>(positions);
+        assert(word < trackers_validation_status_.Size());
+        uintptr_t newly_invalidated = trackers_validation_status_.Set(word, std::get<1>(positions));
+        while (newly_invalidated) {
+          size_t slot = word * bits + bitops::CountTrailingZeros(newly_invalidated);
+          newly_invalidated = newly_invalidated & (newly_invalidated - 1);
+          assert(trackers_output_[slot]);
+          if (mode_ == UpdateMode::Push) {
+            Enqueue(slot);
+          }
+          const TrackedPositionSet& downstream = trackers_output_[slot]->TrackedPositions();
+          queue.insert(queue.end(), downstream.begin(), downstream.end());
+        }
+      }
+    }
+
+    template<typename T>
+    T Argument(const T& value) {
+      return value;
+    }
+  }
+
+  // One write to a DVector: count elements from first on were inserted, erased or updated. The
+  // positions are those right after the write, for an erase those right before it.
+  struct VectorChange {
+    enum Kind {
+      Insert,
+      Erase,
+      Update
+    };
+
+    Kind kind;
+    size_t first;
+    size_t count;
+  };
+
+  namespace detail
+  {
+    // The writes which led to a vector, shared by the VectorDeltas handed out for it.
+    class VectorJournal {
+    public:
+      // Elements per chunk of the dirty bits.
+      static const size_t kChunkSize = sizeof(uintptr_t) * CHAR_BIT;
+
+      VectorJournal()
+        : entries_()
+        , revision_(1)
+        , base_(1)
+        , stamp_(0)
+        , dirty_chunks_() {
+
+      }
+
+      uint64_t Revision() const { return revision_; }
+
+      // Every change after it is known.
+      uint64_t Base() const { return base_; }
+
+      template<typename F>
+      bool ForEachChangeSince(uint64_t revision, F&& visitor) const {
+        if (revision < base_) {
+          return false;
+        }
+        std::vector<Entry>::const_iterator entry = std::upper_bound(
+          entries_.begin(),
+          entries_.end(),
+          revision,
+          [] (uint64_t revision, const Entry& entry) { return revision < entry.revision; }
+        );
+        for (; entry != entries_.end(); ++entry) {
+          visitor(entry->change);
+        }
+        return true;
+      }
+
+      template<typename F>
+      void ForEachDirtyChunk(F&& visitor) const {
+        ForEachNonZeroWord(
+          dirty_chunks_.data(),
+          dirty_chunks_.size(),
+          [&visitor] (size_t word, uintptr_t dirty) {
+            while (dirty) {
+              visitor(word * (sizeof(uintptr_t) * CHAR_BIT) + bitops::CountTrailingZeros(dirty));
+              dirty = dirty & (dirty - 1);
+            }
+          }
+        );
+      }
+
+      // size is the larger of the element counts before and after the write. The journal restarts
+      // when stamp differs from the one it started with, which happens once every watcher is up
+      // to date, or when it got too long to beat a rebuild; a watcher left behind rebuilds.
+      void Record(VectorChange::Kind kind, size_t first, size_t count, size_t size, uint64_t stamp) {
+        if (stamp != stamp_ || entries_.size() >= (size / 8 > kMinimum ? size / 8 : kMinimum)) {
+          Clear(stamp);
+        }
+        ++revision_;
+        entries_.push_back(Entry{revision_, VectorChange{kind, first, count}});
+        size_t end = kind == VectorChange::Update ? first + count : size;
+        if (first < end) {
+          MarkDirty(first / kChunkSize, (end - 1) / kChunkSize);
+        }
+      }
+
+      // Forgets every change, all watchers rebuild.
+      void Restart(uint64_t stamp) {
+        ++revision_;
+        Clear(stamp);
+      }
+
+    private:
+      struct Entry {
+        uint64_t revision;
+        VectorChange change;
+      };
+
+      // Smallest journal which is dropped for being long, longer ones may reach an eighth of the size.
+      static const size_t kMinimum = 64;
+
+      void Clear(uint64_t stamp) {
+        entries_.clear();
+        base_ = revision_;
+        stamp_ = stamp;
+        std::fill(dirty_chunks_.begin(), dirty_chunks_.end(), 0);
+      }
+
+      void MarkDirty(size_t first_chunk, size_t last_chunk) {
+        const size_t width = sizeof(uintptr_t) * CHAR_BIT;
+        if (dirty_chunks_.size() <= last_chunk / width) {
+          dirty_chunks_.resize(last_chunk / width + 1, 0);
+        }
+        for (size_t word = first_chunk / width; word <= last_chunk / width; ++word) {
+          uintptr_t bits = ~static_cast<uintptr_t>(0);
+          if (word == first_chunk / width) {
+            bits &= ~static_cast<uintptr_t>(0) << (first_chunk % width);
+          }
+          if (word == last_chunk / width) {
+            bits &= ~static_cast<uintptr_t>(0) >> (width - 1 - last_chunk % width);
+          }
+          dirty_chunks_[word] |= bits;
+        }
+      }
+
+      std::vector<Entry> entries_;
+      uint64_t revision_;
+      uint64_t base_;
+      uint64_t stamp_;
+      std::vector<uintptr_t> dirty_chunks_;
+    };
+  }
+
+  // What a tracker watching a DVector, or one of the incremental trackers below, as a
+  // VectorDelta<T> gets: the elements and the writes which led to them. Copies are cheap and
+  // share both. A copy of the delta of a DVector is valid while the DVector, or a tracker watching
+  // it, is alive. A calculator keeping state remembers Revision() and asks for the changes since
+  // then on its next call. It starts from revision 0, which has to rebuild from Items().
+  template<typename T>
+  class VectorDelta {
+  public:
+    template<typename U>
+    friend class DVector;
+    template<typename U>
+    friend VectorDelta<U> detail::PublishedCopy(const VectorDelta<U>& delta);
+
+    static const size_t kChunkSize = detail::VectorJournal::kChunkSize;
+
+    VectorDelta()
+      : items_()
+      , journal_()
+      , revision_(0) {
+
+    }
+
+    // items and journal are owned by whatever hands the delta out.
+    VectorDelta(std::shared_ptr<const std::vector<T>> items, std::shared_ptr<const detail::VectorJournal> journal)
+      : items_(std::move(items))
+      , journal_(std::move(journal))
+      , revision_(journal_->Revision()) {
+
+    }
+
+    const std::vector<T>& Items() const {
+      static const std::vector<T> empty;
+      return items_ ? *items_ : empty;
+    }
+
+    uint64_t Revision() const { return revision_; }
+
+    // ForEachChangeSince accepts the revisions from it on.
+    uint64_t OldestRevision() const { return journal_ ? journal_->Base() : 0; }
+
+    // Calls visitor with each change made after revision, in order. Returns false without calling
+    // it when those changes are no longer known, the caller then rebuilds from Items(). Elements
+    // may have moved or changed again since a change, read them once every change is applied.
+    template<typename F>
+    bool ForEachChangeSince(uint64_t revision, F&& visitor) const {
+      return journal_ ? journal_->ForEachChangeSince(revision, std::forward<F>(visitor)) : true;
+    }
+
+    // Calls visitor with each chunk holding an element written since OldestRevision(), so it
+    // covers the changes since any revision ForEachChangeSince accepts. Inserts and erases dirty
+    // every chunk from their first position on.
+    template<typename F>
+    void ForEachDirtyChunk(F&& visitor) const {
+      if (journal_) {
+        journal_->ForEachDirtyChunk(std::forward<F>(visitor));
+      }
+    }
+
+    // Deltas differ when their vector does or when it was written in between.
+    bool operator!=(const VectorDelta& another) const {
+      return items_ != another.items_ || revision_ != another.revision_;
+    }
+
+  private:
+    std::shared_ptr<const std::vector<T>> items_;
+    std::shared_ptr<const detail::VectorJournal> journal_;
+    uint64_t revision_;
+  };
+
+  namespace detail
+  {
+    template<typename T>
+    VectorDelta<T> PublishedCopy(const VectorDelta<T>& delta) {
+      VectorDelta<T> copy;
+      if (delta.items_) {
+        copy.items_ = std::make_shared<const std::vector<T>>(*delta.items_);
+        copy.journal_ = std::make_shared<const VectorJournal>(*delta.journal_);
+        copy.revision_ = delta.revision_;
+      }
+      return copy;
+    }
+  }
+
+  // DValues and DTrackers only point at the DTrack they are created with, it or one of its copies
+  // has to outlive them. Debug builds assert that no node is left when the last copy goes away.
+  class DTrack {
+  public:
+    template<typename T, typename P>
+    friend class DValue;
+    template<typename T, typename... N>
+    friend class DTracker;
+    template<typename T>
+    friend class DVector;
+    template<typename K, typename V>
+    friend class DMap;
+    template<typename T>
+    friend class DAutoTracker;
+
+  public:
+    DTrack()
+      : global_block_(std::make_shared<detail::GlobalBlock>()) {
+
+    }
+
+    explicit DTrack(ThreadMode thread_mode)
+      : global_block_(std::make_shared<detail::GlobalBlock>(thread_mode)) {
+
+    }
+
+    void Apply() {
+      global_block_->Apply();
+    }
+
+    // Trackers of the same height are evaluated on worker_count threads during Apply, their
+    // calculators must then be safe to call concurrently. 0 and 1 evaluate on the calling thread.
+    void SetWorkerCount(size_t worker_count) {
+      global_block_->SetWorkerCount(worker_count);
+    }
+
+    // Switching to push recalculates every invalid tracker right away. Trackers which start
+    // watching a value in push mode are recalculated with the next write or Apply.
+    void SetUpdateMode(UpdateMode mode) {
+      global_block_->SetUpdateMode(mode);
+    }
+
+    const UpdateStatistics& Statistics() const {
+      return global_block_->Statistics();
+    }
+
+    // Every Apply from then on publishes the values changed since the last one as a new epoch
+    // for Snapshot to read. Has to be called before the first DValue or DTracker is created.
+    void EnableSnapshots() {
+      global_block_->EnableSnapshots();
+    }
+
+    // Pins the epoch published by the latest Apply. Reads through a snapshot take no lock and
+    // see that epoch of every value, however the graph changes meanwhile; values created after
+    // it read as default constructed. Snapshots may be taken and read on any thread, and a
+    // reference read through one stays valid while both the snapshot and the read DValue or
+    // DTracker live. Versions no snapshot can reach are freed by the following Apply. At most 64
+    // snapshots of a graph are alive at once, taking another one waits until one of them is
+    // destroyed, so a thread must not hold all 64 itself.
+    class Snapshot {
+    public:
+      explicit Snapshot(const DTrack& global_block)
+        : global_block_(global_block.global_block_.get())
+        , epoch_(0)
+        , slot_(global_block_->PinEpoch(epoch_)) {
+        assert(global_block_->SnapshotsEnabled());
+      }
+
+      ~Snapshot() {
+        global_block_->UnpinEpoch(slot_);
+      }
+
+      Snapshot(const Snapshot&) = delete;
+
+      Snapshot& operator=(const Snapshot&) = delete;
+
+      uint64_t Epoch() const { return epoch_; }
+
+      template<typename T, typename P>
+      const T& Read(const DValue<T, P>& value) const {
+        return detail::VersionRef(*value.tracked_value_, epoch_);
+      }
+
+      template<typename T, typename... N>
+      const T& Read(const DTracker<T, N...>& tracker) const {
+        return detail::VersionRef(*tracker.shared_block_->TrackedValue(), epoch_);
+      }
+
+      template<typename T>
+      const T& Read(const DAutoTracker<T>& tracker) const {
+        return detail::VersionRef(*tracker.shared_block_->TrackedValue(), epoch_);
+      }
+
+    private:
+      detail::GlobalBlock* global_block_;
+      uint64_t epoch_;
+      size_t slot_;
+    };
+
+    // Holds the invalidation of every DValue written while it lives back until it is destroyed,
+    // then invalidates their watchers together and recalculates them in one wave when in push
+    // mode. Writing a DValue several times invalidates its watchers once. Trackers read inside a
+    // transaction do not see its writes yet. Transactions nest, the outermost one commits.
+    class Transaction {
+    public:
+      explicit Transaction(const DTrack& global_block)
+        : global_block_(global_block.global_block_.get()) {
+        global_block_->BeginTransaction();
+      }
+
+      ~Transaction() {
+        global_block_->EndTransaction();
+      }
+
+      Transaction(const Transaction&) = delete;
+
+      Transaction& operator=(const Transaction&) = delete;
+
+    private:
+      detail::GlobalBlock* global_block_;
+    };
+
+  private:
+    std::shared_ptr<detail::GlobalBlock> global_block_;
+  };
+
+  template<typename T, typename Policy>
+  class DValue {
+  public:
+    DValue(const DTrack& global_block)
+      : tracked_value_(detail::MakeNode<detail::Trackable<T>>(global_block.global_block_->Nodes(), global_block.global_block_.get()))
+      , policy_() {
+
+    }
+
+    DValue(const DTrack& global_block, const T& default_value)
+      : tracked_value_(detail::MakeNode<detail::Trackable<T>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), default_value))
+      , policy_() {
+
+    }
+
+    DValue(const DTrack& global_block, T&& default_value)
+      : tracked_value_(detail::MakeNode<detail::Trackable<T>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), std::move(default_value)))
+      , policy_() {
+
+    }
+
+    DValue(const DTrack& global_block, const T& default_value, const Policy& policy)
+      : tracked_value_(detail::MakeNode<detail::Trackable<T>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), default_value))
+      , policy_(policy) {
+
+    }
+
+    DValue(const DValue&) = default;
+
+    DValue(DValue&&) = default;
+
+    // Swaps, the reference held before is dropped by the destructor of another under the lock.
+    DValue& operator=(DValue another) {
+      std::swap(tracked_value_, another.tracked_value_);
+      std::swap(policy_, another.policy_);
+      return *this;
+    }
+
+    // Trackers on other threads of a concurrent graph may be taking or dropping references meanwhile.
+    ~DValue() {
+      if (tracked_value_) {
+        std::unique_lock<std::shared_timed_mutex> lock = tracked_value_->Block()->LockExclusive();
+        tracked_value_.reset();
+      }
+    }
+
+    void SetValue(const T& value) {
+      tracked_value_->SetValue(value, policy_);
+    }
+
+    void SetValue(T&& value) {
+      tracked_value_->SetValue(std::move(value), policy_);
+    }
+
+    // Constructs the new value from args, the old one is kept when the policy finds no change.
+    template<typename... A>
+    void Emplace(A&&... args) {
+      tracked_value_->SetValue(T(std::forward<A>(args)...), policy_);
+    }
+
+    // Calls modifier with a reference to the stored value, trackers are invalidated only when
+    // modifier returns true. The policy is not consulted.
+    template<typename F>
+    void Modify(F&& modifier) {
+      tracked_value_->Modify(std::forward<F>(modifier));
+    }
+
+    // Read inside the calculator of a DAutoTracker, the value becomes one of its inputs.
+    T Value() {
+      detail::ReadCapture::Record(tracked_value_.get());
+      std::shared_lock<std::shared_timed_mutex> lock = tracked_value_->Block()->LockShared();
+      return tracked_value_->Value();
+    }
+
+    // Not guarded in concurrent mode, other threads may write the value while it is referenced.
+    const T& ValueRef() const {
+      detail::ReadCapture::Record(tracked_value_.get());
+      return tracked_value_->ValueRef();
+    }
+
+  public:
+    detail::NodeRef<detail::Trackable<T>> tracked_value_;
+
+  private:
+    Policy policy_;
+  };
+
+  namespace detail
+  {
+    // The delta of a DVector points at the elements without owning them, its node keeps them
+    // alive instead. Copies of the delta are dropped anywhere, a node only under the graph lock.
+    template<typename T>
+    class DeltaTrackable : public Trackable<VectorDelta<T>> {
+    public:
+      DeltaTrackable(GlobalBlock* global_block, NodeRef<Trackable<std::vector<T>>> items, std::shared_ptr<const VectorJournal> journal)
+        : Trackable<VectorDelta<T>>(
+          global_block,
+          VectorDelta<T>(std::shared_ptr<const std::vector<T>>(std::shared_ptr<const std::vector<T>>(), &items->ValueRef()), std::move(journal))
+        )
+        , items_(std::move(items)) {
+
+      }
+
+    private:
+      NodeRef<Trackable<std::vector<T>>> items_;
+    };
+  }
+
+  // A vector whose trackers watch it either as a whole, as a const std::vector<T>&, or as a
+  // const VectorDelta<T>& which also lists the writes, so that they can update their result in
+  // proportion to the change. Both kinds of watchers are invalidated together by every write.
+  template<typename T>
+  class DVector {
+  public:
+    template<typename R, typename... N>
+    friend class DTracker;
+
+    DVector(const DTrack& global_block)
+      : items_(detail::MakeNode<detail::Trackable<std::vector<T>>>(global_block.global_block_->Nodes(), global_block.global_block_.get()))
+      , journal_(std::make_shared<detail::VectorJournal>())
+      , delta_(detail::MakeNode<detail::DeltaTrackable<T>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), items_, journal_)) {
+
+    }
+
+    DVector(const DTrack& global_block, std::vector<T> items)
+      : items_(detail::MakeNode<detail::Trackable<std::vector<T>>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), std::move(items)))
+      , journal_(std::make_shared<detail::VectorJournal>())
+      , delta_(detail::MakeNode<detail::DeltaTrackable<T>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), items_, journal_)) {
+
+    }
+
+    DVector(const DVector&) = default;
+
+    DVector(DVector&&) = default;
+
+    DVector& operator=(DVector another) {
+      std::swap(items_, another.items_);
+      std::swap(journal_, another.journal_);
+      std::swap(delta_, another.delta_);
+      return *this;
+    }
+
+    ~DVector() {
+      if (items_) {
+        std::unique_lock<std::shared_timed_mutex> lock = items_->Block()->LockExclusive();
+        delta_.reset();
+        items_.reset();
+      }
+    }
+
+    void Set(size_t index, const T& value) {
+      Write(VectorChange::Update, index, 1, [&] (std::vector<T>& items) { items[index] = value; });
+    }
+
+    void Set(size_t index, T&& value) {
+      Write(VectorChange::Update, index, 1, [&] (std::vector<T>& items) { items[index] = std::move(value); });
+    }
+
+    // Calls modifier with each element of [first, first + count) to change it in place.
+    template<typename F>
+    void Modify(size_t first, size_t count, F&& modifier) {
+      Write(
+        VectorChange::Update,
+        first,
+        count,
+        [&] (std::vector<T>& items) {
+          for (size_t i = first; i < first + count; ++i) {
+            modifier(items[i]);
+          }
+        }
+      );
+    }
+
+    void Insert(size_t index, const T& value) {
+      Write(VectorChange::Insert, index, 1, [&] (std::vector<T>& items) { items.insert(items.begin() + index, value); });
+    }
+
+    void Insert(size_t index, T&& value) {
+      Write(VectorChange::Insert, index, 1, [&] (std::vector<T>& items) { items.insert(items.begin() + index, std::move(value)); });
+    }
+
+    template<typename I>
+    void Insert(size_t index, I first, I last) {
+      Write(
+        VectorChange::Insert,
+        index,
+        static_cast<size_t>(std::distance(first, last)),
+        [&] (std::vector<T>& items) { items.insert(items.begin() + index, first, last); }
+      );
+    }
+
+    void PushBack(const T& value) {
+      Insert(items_->ValueRef().size(), value);
+    }
+
+    void PushBack(T&& value) {
+      Insert(items_->ValueRef().size(), std::move(value));
+    }
+
+    void Erase(size_t first, size_t count = 1) {
+      Write(
+        VectorChange::Erase,
+        first,
+        count,
+        [&] (std::vector<T>& items) { items.erase(items.begin() + first, items.begin() + first + count); }
+      );
+    }
+
+    // Replaces every element, delta watchers see it as an erase of all followed by an insert.
+    void Assign(std::vector<T> items) {
+      {
+        std::unique_lock<std::shared_timed_mutex> lock = items_->Block()->LockExclusive();
+        size_t old_size = items_->ValueRef().size();
+        size_t new_size = items.size();
+        uint64_t drains = items_->Block()->Drains();
+        items_->ModifyUnpublished([&items] (std::vector<T>& stored) { stored.swap(items); return true; });
+        journal_->Record(VectorChange::Erase, 0, old_size, old_size, drains);
+        journal_->Record(VectorChange::Insert, 0, new_size, new_size, drains);
+        delta_->ModifyUnpublished([this] (VectorDelta<T>& delta) { delta.revision_ = journal_->Revision(); return true; });
+      }
+      Publish();
+    }
+
+    size_t Size() const {
+      std::shared_lock<std::shared_timed_mutex> lock = items_->Block()->LockShared();
+      return items_->ValueRef().size();
+    }
+
+    std::vector<T> Value() const {
+      std::shared_lock<std::shared_timed_mutex> lock = items_->Block()->LockShared();
+      return items_->Value();
+    }
+
+    // Not guarded in concurrent mode, other threads may write the vector while it is referenced.
+    const std::vector<T>& ValueRef() const { return items_->ValueRef(); }
+
+    const T& operator[](size_t index) const { return items_->ValueRef()[index]; }
+
+  private:
+    // change edits the elements. Both halves change under one lock, so that a tracker reading
+    // the delta never sees elements its journal does not account for.
+    template<typename F>
+    void Write(VectorChange::Kind kind, size_t first, size_t count, F&& change) {
+      {
+        std::unique_lock<std::shared_timed_mutex> lock = items_->Block()->LockExclusive();
+        size_t old_size = items_->ValueRef().size();
+        items_->ModifyUnpublished([&change] (std::vector<T>& items) { change(items); return true; });
+        size_t size = std::max(old_size, items_->ValueRef().size());
+        journal_->Record(kind, first, count, size, items_->Block()->Drains());
+        delta_->ModifyUnpublished([this] (VectorDelta<T>& delta) { delta.revision_ = journal_->Revision(); return true; });
+      }
+      Publish();
+    }
+
+    // Batches the two invalidations, in push mode trackers watching both recalculate once.
+    void Publish() {
+      detail::GlobalBlock* global_block = items_->Block();
+      if (global_block->Concurrent()) {
+        items_->Publish();
+        delta_->Publish();
+        return;
+      }
+      global_block->BeginTransaction();
+      items_->Publish();
+      delta_->Publish();
+      global_block->EndTransaction();
+    }
+
+    const detail::NodeRef<detail::Trackable<std::vector<T>>>& Watched(const std::vector<T>*) const { return items_; }
+
+    const detail::NodeRef<detail::Trackable<VectorDelta<T>>>& Watched(const VectorDelta<T>*) const { return delta_; }
+
+    detail::NodeRef<detail::Trackable<std::vector<T>>> items_;
+    std::shared_ptr<detail::VectorJournal> journal_;
+    detail::NodeRef<detail::Trackable<VectorDelta<T>>> delta_;
+  };
+
+  namespace detail
+  {
+    // Elements and journal of the output of an incremental tracker.
+    template<typename T>
+    struct DerivedVector {
+      std::vector<T> items;
+      VectorJournal journal;
+    };
+
+    template<typename T>
+    VectorDelta<T> DeltaOf(const std::shared_ptr<DerivedVector<T>>& vector) {
+      return VectorDelta<T>(
+        std::shared_ptr<const std::vector<T>>(vector, &vector->items),
+        std::shared_ptr<const VectorJournal>(vector, &vector->journal)
+      );
+    }
+
+    // Replays the changes of delta since revision on state kept per element. erase(first, count)
+    // and insert(first, count) run in order with the positions of their change, then dirty holds
+    // the sorted disjoint ranges [first, last) of inserted or updated elements, as positions after
+    // the last change. Returns false, calling neither, when the changes are unknown or shifting
+    // the ranges along would cost more than a rebuild.
+    template<typename T, typename E, typename I>
+    bool ReplayChanges(
+      const VectorDelta<T>& delta,
+      uint64_t revision,
+      E&& erase,
+      I&& insert,
+      std::vector<std::pair<size_t, size_t>>& dirty
+    ) {
+      dirty.clear();
+      size_t changes = 0;
+      size_t moves = 0;
+      bool known = delta.ForEachChangeSince(
+        revision,
+        [&changes, &moves] (const VectorChange& change) {
+          ++changes;
+          moves += change.kind != VectorChange::Update ? 1 : 0;
+        }
+      );
+      if (!known || moves * changes > delta.Items().size() + 64) {
+        return false;
+      }
+      delta.ForEachChangeSince(
+        revision,
+        [&] (const VectorChange& change) {
+          size_t first = change.first;
+          size_t last = change.first + change.count;
+          switch (change.kind) {
+          case VectorChange::Insert:
+            // A range split by the insert merges with the inserted one anyway.
+            for (std::pair<size_t, size_t>& range : dirty) {
+              if (range.first >= first) {
+                range.first += change.count;
+              }
+              if (range.second > first) {
+                range.second += change.count;
+              }
+            }
+            insert(first, change.count);
+            dirty.emplace_back(first, last);
+            break;
+          case VectorChange::Erase:
+            for (std::pair<size_t, size_t>& range : dirty) {
+              range.first = range.first <= first ? range.first : range.first < last ? first : range.first - change.count;
+              range.second = range.second <= first ? range.second : range.second < last ? first : range.second - change.count;
+            }
+            erase(first, change.count);
+            break;
+          case VectorChange::Update:
+            dirty.emplace_back(first, last);
+            break;
+          }
+        }
+      );
+      std::sort(dirty.begin(), dirty.end());
+      size_t kept = 0;
+      for (size_t i = 0; i < dirty.size(); ++i) {
+        if (dirty[i].first == dirty[i].second) {
+          continue;
+        }
+        if (kept > 0 && dirty[kept - 1].second >= dirty[i].first) {
+          dirty[kept - 1].second = std::max(dirty[kept - 1].second, dirty[i].second);
+        } else {
+          dirty[kept++] = dirty[i];
+        }
+      }
+      dirty.resize(kept);
+      return true;
+    }
+
+    // Counts the set flags before a position in O(log n), a Fenwick tree.
+    class CountTree {
+    public:
+      CountTree()
+        : counts_() {
+
+      }
+
+      void Build(const std::vector<char>& flags) {
+        counts_.assign(flags.size() + 1, 0);
+        for (size_t i = 1; i <= flags.size(); ++i) {
+          counts_[i] += flags[i - 1] ? 1 : 0;
+          size_t parent = i + (i & (~i + 1));
+          if (parent <= flags.size()) {
+            counts_[parent] += counts_[i];
+          }
+        }
+      }
+
+      // Set flags in [0, position).
+      size_t CountBefore(size_t position) const {
+        size_t count = 0;
+        for (; position > 0; position &= position - 1) {
+          count += counts_[position];
+        }
+        return count;
+      }
+
+      void Set(size_t position, bool set) {
+        for (++position; position < counts_.size(); position += position & (~position + 1)) {
+          set ? ++counts_[position] : --counts_[position];
+        }
+      }
+
+    private:
+      std::vector<size_t> counts_;
+    };
+  }
+
+  // The incremental trackers are calculators for a DTracker watching a DVector, or another
+  // incremental tracker, as a VectorDelta. They keep state between calls and only redo the work
+  // for the elements written since the last one: mapper, predicate, combine and compare are
+  // called O(k) or O(k log n) times for k written elements. Their vector outputs are
+  // VectorDeltas again, so they chain. Inserts and erases still move the elements behind them
+  // like std::vector does. Each one feeds one tracker, they can be moved but not copied.
+
+  // The output holds mapper(element) for each input element.
+  template<typename T, typename F>
+  class IncrementalMap {
+  public:
+    typedef std::decay_t<decltype(std::declval<F&>()(std::declval<const T&>()))> Result;
+
+    explicit IncrementalMap(F mapper)
+      : mapper_(std::move(mapper))
+      , output_(std::make_shared<detail::DerivedVector<Result>>())
+      , revision_(0)
+      , dirty_() {
+
+    }
+
+    IncrementalMap(const IncrementalMap&) = delete;
+
+    IncrementalMap(IncrementalMap&&) = default;
+
+    VectorDelta<Result> operator()(const VectorDelta<T>& input) {
+      const std::vector<T>& items = input.Items();
+      std::vector<Result>& output = output_->items;
+      detail::VectorJournal& journal = output_->journal;
+      uint64_t stamp = input.OldestRevision();
+      bool replayed = detail::ReplayChanges(
+        input,
+        revision_,
+        [&output, &journal, stamp] (size_t first, size_t count) {
+          output.erase(output.begin() + first, output.begin() + first + count);
+          journal.Record(VectorChange::Erase, first, count, output.size() + count, stamp);
+        },
+        [&output, &journal, stamp] (size_t first, size_t count) {
+          output.insert(output.begin() + first, count, Result());
+          journal.Record(VectorChange::Insert, first, count, output.size(), stamp);
+        },
+        dirty_
+      );
+      if (replayed) {
+        for (const std::pair<size_t, size_t>& range : dirty_) {
+          for (size_t i = range.first; i < range.second; ++i) {
+            output[i] = mapper_(items[i]);
+          }
+          journal.Record(VectorChange::Update, range.first, range.second - range.first, output.size(), stamp);
+        }
+      } else {
+        output.clear();
+        output.reserve(items.size());
+        for (const T& item : items) {
+          output.push_back(mapper_(item));
+        }
+        journal.Restart(stamp);
+      }
+      revision_ = input.Revision();
+      return detail::DeltaOf(output_);
+    }
+
+  private:
+    F mapper_;
+    std::shared_ptr<detail::DerivedVector<Result>> output_;
+    uint64_t revision_;
+    std::vector<std::pair<size_t, size_t>> dirty_;
+  };
+
+  // The output holds the input elements for which predicate returns true, in input order. Updates
+  // find their output position by counting the passing elements before them in O(log n), inserts
+  // and erases copy the output once.
+  template<typename T, typename F>
+  class IncrementalFilter {
+  public:
+    explicit IncrementalFilter(F predicate)
+      : predicate_(std::move(predicate))
+      , output_(std::make_shared<detail::DerivedVector<T>>())
+      , passes_()
+      , passing_()
+      , revision_(0)
+      , dirty_() {
+
+    }
+
+    IncrementalFilter(const IncrementalFilter&) = delete;
+
+    IncrementalFilter(IncrementalFilter&&) = default;
+
+    VectorDelta<T> operator()(const VectorDelta<T>& input) {
+      const std::vector<T>& items = input.Items();
+      std::vector<T>& output = output_->items;
+      detail::VectorJournal& journal = output_->journal;
+      uint64_t stamp = input.OldestRevision();
+      bool moved = false;
+      bool replayed = detail::ReplayChanges(
+        input,
+        revision_,
+        [this, &moved] (size_t first, size_t count) {
+          passes_.erase(passes_.begin() + first, passes_.begin() + first + count);
+          moved = true;
+        },
+        [this, &moved] (size_t first, size_t count) {
+          passes_.insert(passes_.begin() + first, count, 0);
+          moved = true;
+        },
+        dirty_
+      );
+      if (!replayed) {
+        passes_.assign(items.size(), 0);
+        dirty_.assign(1, std::make_pair(static_cast<size_t>(0), items.size()));
+        moved = true;
+      }
+      if (moved) {
+        for (const std::pair<size_t, size_t>& range : dirty_) {
+          for (size_t i = range.first; i < range.second; ++i) {
+            passes_[i] = predicate_(items[i]) ? 1 : 0;
+          }
+        }
+        output.clear();
+        for (size_t i = 0; i < items.size(); ++i) {
+          if (passes_[i]) {
+            output.push_back(items[i]);
+          }
+        }
+        passing_.Build(passes_);
+        journal.Restart(stamp);
+      } else {
+        for (const std::pair<size_t, size_t>& range : dirty_) {
+          for (size_t i = range.first; i < range.second; ++i) {
+            bool passed = passes_[i] != 0;
+            bool passes = predicate_(items[i]);
+            size_t position = passing_.CountBefore(i);
+            if (passed && passes) {
+              output[position] = items[i];
+              journal.Record(VectorChange::Update, position, 1, output.size(), stamp);
+            } else if (passes) {
+              output.insert(output.begin() + position, items[i]);
+              journal.Record(VectorChange::Insert, position, 1, output.size(), stamp);
+            } else if (passed) {
+              output.erase(output.begin() + position);
+              journal.Record(VectorChange::Erase, position, 1, output.size() + 1, stamp);
+            }
+            if (passed != passes) {
+              passes_[i] = passes ? 1 : 0;
+              passing_.Set(i, passes);
+            }
+          }
+        }
+      }
+      revision_ = input.Revision();
+      return detail::DeltaOf(output_);
+    }
+
+  private:
+    F predicate_;
+    std::shared_ptr<detail::DerivedVector<T>> output_;
+    std::vector<char> passes_;
+    detail::CountTree passing_;
+    uint64_t revision_;
+    std::vector<std::pair<size_t, size_t>> dirty_;
+  };
+
+  // Folds the input with combine, which has to be associative with identity as its neutral
+  // element; it need not be commutative. A segment tree keeps the partial folds, so an update
+  // combines O(log n) nodes again. Inserts and erases rebuild the tree.
+  template<typename T, typename F>
+  class IncrementalReduce {
+  public:
+    IncrementalReduce(F combine, T identity)
+      : combine_(std::move(combine))
+      , identity_(std::move(identity))
+      , tree_(2, identity_)
+      , leaves_(1)
+      , size_(0)
+      , revision_(0)
+      , updated_() {
+
+    }
+
+    IncrementalReduce(const IncrementalReduce&) = delete;
+
+    IncrementalReduce(IncrementalReduce&&) = default;
+
+    T operator()(const VectorDelta<T>& input) {
+      const std::vector<T>& items = input.Items();
+      bool moved = false;
+      updated_.clear();
+      bool known = input.ForEachChangeSince(
+        revision_,
+        [this, &moved] (const VectorChange& change) {
+          if (change.kind != VectorChange::Update) {
+            moved = true;
+          } else if (!moved) {
+            updated_.push_back(change);
+          }
+        }
+      );
+      if (!known || moved || size_ != items.size()) {
+        Build(items);
+      } else {
+        for (const VectorChange& change : updated_) {
+          for (size_t i = change.first; i < change.first + change.count; ++i) {
+            size_t node = leaves_ + i;
+            tree_[node] = items[i];
+            for (node /= 2; node > 0; node /= 2) {
+              tree_[node] = combine_(tree_[2 * node], tree_[2 * node + 1]);
+            }
+          }
+        }
+      }
+      revision_ = input.Revision();
+      return tree_[1];
+    }
+
+  private:
+    // Leaves are padded with identity up to a power of two, so the root folds them in order.
+    void Build(const std::vector<T>& items) {
+      size_ = items.size();
+      leaves_ = 1;
+      while (leaves_ < size_) {
+        leaves_ *= 2;
+      }
+      tree_.assign(2 * leaves_, identity_);
+      std::copy(items.begin(), items.end(), tree_.begin() + leaves_);
+      for (size_t node = leaves_ - 1; node > 0; --node) {
+        tree_[node] = combine_(tree_[2 * node], tree_[2 * node + 1]);
+      }
+    }
+
+    F combine_;
+    T identity_;
+    std::vector<T> tree_;
+    size_t leaves_;
+    size_t size_;
+    uint64_t revision_;
+    std::vector<VectorChange> updated_;
+  };
+
+  // The output holds the input elements ordered by compare. Elements compare finds equivalent are
+  // taken as interchangeable: their order in the output is unspecified. A written element leaves
+  // and enters the output by binary search; past kBatch of them the output is merged in one pass.
+  template<typename T, typename Compare = std::less<T>>
+  class IncrementalSort {
+  public:
+    static const size_t kBatch = 64;
+
+    explicit IncrementalSort(Compare compare = Compare())
+      : compare_(std::move(compare))
+      , output_(std::make_shared<detail::DerivedVector<T>>())
+      , keys_()
+      , present_()
+      , removed_()
+      , revision_(0)
+      , dirty_() {
+
+    }
+
+    IncrementalSort(const IncrementalSort&) = delete;
+
+    IncrementalSort(IncrementalSort&&) = default;
+
+    VectorDelta<T> operator()(const VectorDelta<T>& input) {
+      const std::vector<T>& items = input.Items();
+      std::vector<T>& output = output_->items;
+      detail::VectorJournal& journal = output_->journal;
+      uint64_t stamp = input.OldestRevision();
+      // keys_ holds each element as the output has it, present_ whether it is in the output yet.
+      // Erased keys leave the output together with the old keys of the written elements.
+      removed_.clear();
+      bool replayed = detail::ReplayChanges(
+        input,
+        revision_,
+        [this] (size_t first, size_t count) {
+          for (size_t i = first; i < first + count; ++i) {
+            if (present_[i]) {
+              removed_.push_back(std::move(keys_[i]));
+            }
+          }
+          keys_.erase(keys_.begin() + first, keys_.begin() + first + count);
+          present_.erase(present_.begin() + first, present_.begin() + first + count);
+        },
+        [this] (size_t first, size_t count) {
+          keys_.insert(keys_.begin() + first, count, T());
+          present_.insert(present_.begin() + first, count, 0);
+        },
+        dirty_
+      );
+      size_t written = removed_.size();
+      for (const std::pair<size_t, size_t>& range : dirty_) {
+        written += range.second - range.first;
+      }
+      if (!replayed) {
+        keys_ = items;
+        present_.assign(items.size(), 1);
+        output = items;
+        std::sort(output.begin(), output.end(), compare_);
+        journal.Restart(stamp);
+      } else if (written > kBatch) {
+        Merge(items);
+        journal.Restart(stamp);
+      } else {
+        for (const T& key : removed_) {
+          size_t position = Find(key);
+          output.erase(output.begin() + position);
+          journal.Record(VectorChange::Erase, position, 1, output.size() + 1, stamp);
+        }
+        for (const std::pair<size_t, size_t>& range : dirty_) {
+          for (size_t i = range.first; i < range.second; ++i) {
+            if (present_[i]) {
+              size_t position = Find(keys_[i]);
+              output.erase(output.begin() + position);
+              journal.Record(VectorChange::Erase, position, 1, output.size() + 1, stamp);
+            }
+            keys_[i] = items[i];
+            present_[i] = 1;
+            size_t position = std::upper_bound(output.begin(), output.end(), keys_[i], compare_) - output.begin();
+            output.insert(output.begin() + position, keys_[i]);
+            journal.Record(VectorChange::Insert, position, 1, output.size(), stamp);
+          }
+        }
+      }
+      revision_ = input.Revision();
+      return detail::DeltaOf(output_);
+    }
+
+  private:
+    size_t Find(const T& key) const {
+      const std::vector<T>& output = output_->items;
+      size_t position = std::lower_bound(output.begin(), output.end(), key, compare_) - output.begin();
+      assert(position < output.size() && !compare_(key, output[position]));
+      return position;
+    }
+
+    // Drops the erased keys and the old keys of the written elements in one pass, then merges
+    // in the sorted new ones.
+    void Merge(const std::vector<T>& items) {
+      std::vector<T>& output = output_->items;
+      std::vector<char> dropped(output.size(), 0);
+      for (const T& key : removed_) {
+        Drop(key, dropped);
+      }
+      for (const std::pair<size_t, size_t>& range : dirty_) {
+        for (size_t i = range.first; i < range.second; ++i) {
+          if (present_[i]) {
+            Drop(keys_[i], dropped);
+          }
+        }
+      }
+      size_t kept = 0;
+      for (size_t i = 0; i < output.size(); ++i) {
+        if (!dropped[i]) {
+          if (kept != i) {
+            output[kept] = std::move(output[i]);
+          }
+          ++kept;
+        }
+      }
+      output.resize(kept);
+      for (const std::pair<size_t, size_t>& range : dirty_) {
+        for (size_t i = range.first; i < range.second; ++i) {
+          keys_[i] = items[i];
+          present_[i] = 1;
+          output.push_back(items[i]);
+        }
+      }
+      std::sort(output.begin() + kept, output.end(), compare_);
+      std::inplace_merge(output.begin(), output.begin() + kept, output.end(), compare_);
+    }
+
+    // Marks an output element equivalent to key which is not marked yet.
+    void Drop(const T& key, std::vector<char>& dropped) const {
+      size_t position = Find(key);
+      while (dropped[position]) {
+        ++position;
+      }
+      dropped[position] = 1;
+    }
+
+    Compare compare_;
+    std::shared_ptr<detail::DerivedVector<T>> output_;
+    std::vector<T> keys_;
+    std::vector<char> present_;
+    std::vector<T> removed_;
+    uint64_t revision_;
+    std::vector<std::pair<size_t, size_t>> dirty_;
+  };
+
+  // A hash map whose trackers watch one key, as a const V&, the keys in [low, high) by operator<,
+  // as a const std::map<K, V>&, or the whole map, as a const std::unordered_map<K, V>&. A write
+  // invalidates the watchers of its key, of the ranges holding it and of the whole map only. A
+  // missing key reads as a default constructed V. Keys and ranges are given a value of their own
+  // when first watched, which is dropped by a write once nothing watches it any more. The ends of
+  // the watched ranges cut the keys into slabs, each listing the ranges covering it, so a write
+  // only visits the ranges holding its key. A range is listed in every slab it covers.
+  template<typename K, typename V>
+  class DMap {
+  public:
+    template<typename R, typename... N>
+    friend class DTracker;
+
+    typedef K Key;
+
+    DMap(const DTrack& global_block)
+      : items_(detail::MakeNode<detail::Trackable<std::unordered_map<K, V>>>(global_block.global_block_->Nodes(), global_block.global_block_.get()))
+      , watched_(std::make_shared<Watched>()) {
+
+    }
+
+    DMap(const DTrack& global_block, std::unordered_map<K, V> items)
+      : items_(detail::MakeNode<detail::Trackable<std::unordered_map<K, V>>>(global_block.global_block_->Nodes(), global_block.global_block_.get(), std::move(items)))
+      , watched_(std::make_shared<Watched>()) {
+
+    }
+
+    DMap(const DMap&) = default;
+
+    DMap(DMap&&) = default;
+
+    DMap& operator=(DMap another) {
+      std::swap(items_, another.items_);
+      std::swap(watched_, another.watched_);
+      return *this;
+    }
+
+    ~DMap() {
+      if (items_) {
+        std::unique_lock<std::shared_timed_mutex> lock = items_->Block()->LockExclusive();
+        watched_.reset();
+        items_.reset();
+      }
+    }
+
+    // Nothing is invalidated when the policy of V finds the value unchanged.
+    void Set(const K& key, V value) {
+      Write(key, [&value] (std::unordered_map<K, V>& items, const K& key) {
+        typename ChangePolicy<V>::type policy;
+        typename std::unordered_map<K, V>::iterator item = items.find(key);
+        if (item == items.end()) {
+          items.emplace(key, std::move(value));
+          return true;
+        }
+        if (!policy.Changed(item->second, value)) {
+          return false;
+        }
+        item->second = std::move(value);
+        return true;
+      });
+    }
+
+    void Erase(const K& key) {
+      Write(key, [] (std::unordered_map<K, V>& items, const K& key) { return items.erase(key) > 0; });
+    }
+
+    bool Contains(const K& key) const {
+      std::shared_lock<std::shared_timed_mutex> lock = items_->Block()->LockShared();
+      return items_->ValueRef().count(key) > 0;
+    }
+
+    V Value(const K& key) const {
+      std::shared_lock<std::shared_timed_mutex> lock = items_->Block()->LockShared();
+      return Find(key);
+    }
+
+    size_t Size() const {
+      std::shared_lock<std::shared_timed_mutex> lock = items_->Block()->LockShared();
+      return items_->ValueRef().size();
+    }
+
+    // Not guarded in concurrent mode, other threads may write the map while it is referenced.
+    const std::unordered_map<K, V>& ValueRef() const { return items_->ValueRef(); }
+
+  private:
+    typedef detail::NodeRef<detail::Trackable<V>> KeyValue;
+    typedef detail::NodeRef<detail::Trackable<std::map<K, V>>> RangeValue;
+
+    // By the low and high end.
+    typedef std::map<std::pair<K, K>, RangeValue> Ranges;
+
+    // The keys from bound up to the next bound, bounds counts the ranges ending at bound.
+    struct Slab {
+      size_t bounds;
+      std::vector<typename Ranges::iterator> ranges;
+    };
+
+    // Shared by the copies of a map, guarded by the exclusive lock.
+    struct Watched {
+      std::unordered_map<K, KeyValue> keys;
+      Ranges ranges;
+      std::map<K, Slab> slabs;
+      // Watched for every empty or inverted range, no key falls into those and no write reaches it.
+      RangeValue empty;
+
+      // Starts a slab at bound, covered by the ranges of the slab it is cut from.
+      typename std::map<K, Slab>::iterator Cut(const K& bound) {
+        typename std::map<K, Slab>::iterator next = slabs.lower_bound(bound);
+        if (next != slabs.end() && !(bound < next->first)) {
+          ++next->second.bounds;
+          return next;
+        }
+        Slab slab{1, std::vector<typename Ranges::iterator>()};
+        if (next != slabs.begin()) {
+          slab.ranges = std::prev(next)->second.ranges;
+        }
+        return slabs.emplace_hint(next, bound, std::move(slab));
+      }
+
+      // A slab left without bounds is covered as the one before it, so it merges into that one.
+      void Uncut(typename std::map<K, Slab>::iterator slab) {
+        if (--slab->second.bounds == 0) {
+          slabs.erase(slab);
+        }
+      }
+
+      typename Ranges::iterator Insert(const K& low, const K& high, RangeValue value) {
+        assert(low < high);
+        typename Ranges::iterator range = ranges.emplace(std::make_pair(low, high), std::move(value)).first;
+        typename std::map<K, Slab>::iterator first = Cut(low);
+        typename std::map<K, Slab>::iterator last = Cut(high);
+        for (typename std::map<K, Slab>::iterator slab = first; slab != last; ++slab) {
+          slab->second.ranges.push_back(range);
+        }
+        return range;
+      }
+
+      void Erase(typename Ranges::iterator range) {
+        typename std::map<K, Slab>::iterator first = slabs.find(range->first.first);
+        typename std::map<K, Slab>::iterator last = slabs.find(range->first.second);
+        for (typename std::map<K, Slab>::iterator slab = first; slab != last; ++slab) {
+          std::vector<typename Ranges::iterator>& covering = slab->second.ranges;
+          covering.erase(std::find(covering.begin(), covering.end(), range));
+        }
+        Uncut(first);
+        Uncut(last);
+        ranges.erase(range);
+      }
+    };
+
+    const V& Find(const K& key) const {
+      static const V empty = V();
+      typename std::unordered_map<K, V>::const_iterator item = items_->ValueRef().find(key);
+      return item == items_->ValueRef().end() ? empty : item->second;
+    }
+
+    // change writes key into the items and returns whether it changed them. The values of the key
+    // and of the ranges holding it follow under the same lock, then all are published together.
+    template<typename F>
+    void Write(const K& key, F&& change) {
+      detail::GlobalBlock* global_block = items_->Block();
+      KeyValue key_value;
+      std::vector<RangeValue> ranges;
+      {
+        std::unique_lock<std::shared_timed_mutex> lock = global_block->LockExclusive();
+        if (!items_->ModifyUnpublished([&change, &key] (std::unordered_map<K, V>& items) { return change(items, key); })) {
+          return;
+        }
+        typename std::unordered_map<K, V>::const_iterator item = items_->ValueRef().find(key);
+        bool erased = item == items_->ValueRef().end();
+        typename std::unordered_map<K, KeyValue>::iterator watched_key = watched_->keys.find(key);
+        if (watched_key != watched_->keys.end()) {
+          if (watched_key->second->TrackedPositions().empty()) {
+            watched_->keys.erase(watched_key);
+          } else {
+            key_value = watched_key->second;
+            key_value->ModifyUnpublished(
+              [&] (V& value) {
+                value = erased ? V() : item->second;
+                return true;
+              }
+            );
+          }
+        }
+        typename std::map<K, Slab>::iterator slab = watched_->slabs.upper_bound(key);
+        if (slab != watched_->slabs.begin()) {
+          --slab;
+          std::vector<typename Ranges::iterator> unwatched;
+          for (typename Ranges::iterator range : slab->second.ranges) {
+            if (range->second->TrackedPositions().empty()) {
+              unwatched.push_back(range);
+              continue;
+            }
+            ranges.push_back(range->second);
+            ranges.back()->ModifyUnpublished(
+              [&] (std::map<K, V>& value) {
+                if (erased) {
+                  value.erase(key);
+                } else {
+                  value[key] = item->second;
+                }
+                return true;
+              }
+            );
+          }
+          for (typename Ranges::iterator range : unwatched) {
+            watched_->Erase(range);
+          }
+        }
+      }
+      bool batched = !global_block->Concurrent() && (key_value || !ranges.empty());
+      if (batched) {
+        global_block->BeginTransaction();
+      }
+      items_->Publish();
+      if (key_value) {
+        key_value->Publish();
+      }
+      for (const RangeValue& value : ranges) {
+        value->Publish();
+      }
+      if (batched) {
+        global_block->EndTransaction();
+      }
+      // Other writers may drop the values meanwhile, the references go under the lock.
+      if (global_block->Concurrent() && (key_value || !ranges.empty())) {
+        std::unique_lock<std::shared_timed_mutex> lock = global_block->LockExclusive();
+        key_value.reset();
+        ranges.clear();
+      }
+    }
+
+    // Called by DTracker::Watch, which holds the exclusive lock.
+    const KeyValue& WatchedKey(const K& key) const {
+      KeyValue& value = watched_->keys[key];
+      if (!value) {
+        value = detail::MakeNode<detail::Trackable<V>>(items_->Block()->Nodes(), items_->Block(), Find(key));
+      }
+      return value;
+    }
+
+    const RangeValue& WatchedRange(const K& low, const K& high) const {
+      if (!(low < high)) {
+        if (!watched_->empty) {
+          watched_->empty = detail::MakeNode<detail::Trackable<std::map<K, V>>>(items_->Block()->Nodes(), items_->Block());
+        }
+        return watched_->empty;
+      }
+      typename Ranges::iterator same = watched_->ranges.find(std::make_pair(low, high));
+      if (same != watched_->ranges.end()) {
+        return same->second;
+      }
+      std::map<K, V> items;
+      for (const std::pair<const K, V>& item : items_->ValueRef()) {
+        if (!(item.first < low) && item.first < high) {
+          items.emplace(item.first, item.second);
+        }
+      }
+      return watched_->Insert(
+        low,
+        high,
+        detail::MakeNode<detail::Trackable<std::map<K, V>>>(items_->Block()->Nodes(), items_->Block(), std::move(items))
+      )->second;
+    }
+
+    detail::NodeRef<detail::Trackable<std::unordered_map<K, V>>> items_;
+    std::shared_ptr<Watched> watched_;
+  };
+
+  template<typename T, typename F>
+  IncrementalMap<T, std::decay_t<F>> MakeIncrementalMap(F&& mapper) {
+    return IncrementalMap<T, std::decay_t<F>>(std::forward<F>(mapper));
+  }
+
+  template<typename T, typename F>
+  IncrementalFilter<T, std::decay_t<F>> MakeIncrementalFilter(F&& predicate) {
+    return IncrementalFilter<T, std::decay_t<F>>(std::forward<F>(predicate));
+  }
+
+  template<typename T, typename F>
+  IncrementalReduce<T, std::decay_t<F>> MakeIncrementalReduce(F&& combine, T identity) {
+    return IncrementalReduce<T, std::decay_t<F>>(std::forward<F>(combine), std::move(identity));
+  }
+
+  template<typename T, typename... N>
+  class DTracker {
+  public:
+    template<typename R, typename... M>
+    friend class DTracker;
+    friend class DTrack::Snapshot;
+
+    // calculator is any callable taking const N&... and returning a T, it is stored inline.
+    template<typename F>
+    DTracker(const DTrack& global_block, F calculator)
+      : shared_block_(
+        detail::MakeNode<detail::CalculatorTracker<F, T, N...>>(
+          global_block.global_block_->Nodes(),
+          global_block.global_block_.get(),
+          std::move(calculator)
+        )
+      )
+    {
+
+    }
+
+    template<typename F>
+    DTracker(const DTrack& global_block, const T& default_value, F calculator)
+      : shared_block_(
+        detail::MakeNode<detail::CalculatorTracker<F, T, N...>>(
+          global_block.global_block_->Nodes(),
+          global_block.global_block_.get(),
+          default_value,
+          std::move(calculator)
+        )
+      )
+    {
+
+    }
+
+    DTracker(const DTracker&) = default;
+
+    DTracker(DTracker&&) = default;
+
+    DTracker& operator=(DTracker another) {
+      std::swap(shared_block_, another.shared_block_);
+      return *this;
+    }
+
+    // The tracker frees its position and drops its inputs, which other threads of a concurrent
+    // graph may be watching meanwhile.
+    ~DTracker() {
+      if (shared_block_) {
+        std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+        shared_block_.reset();
+      }
+    }
+
+    template<size_t index, typename P>
+    DTracker& Watch(const DValue<std::tuple_element_t<index, std::tuple<N...>>, P>& value) {
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(value.tracked_value_);
+      return *this;
+    }
+
+    template<size_t index, typename... M>
+    DTracker& Watch(const DTracker<std::tuple_element_t<index, std::tuple<N...>>, M...>& tracker) {
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(tracker.shared_block_->TrackedValue());
+      return *this;
+    }
+
+    template<size_t index>
+    DTracker& Watch(const DAutoTracker<std::tuple_element_t<index, std::tuple<N...>>>& tracker) {
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(tracker.shared_block_->TrackedValue());
+      return *this;
+    }
+
+    template<size_t index, typename K, typename V>
+    DTracker& Watch(const DMap<K, V>& map, const typename DMap<K, V>::Key& key) {
+      static_assert(std::is_same<std::tuple_element_t<index, std::tuple<N...>>, V>::value, "a key is watched as its value");
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(map.WatchedKey(key));
+      return *this;
+    }
+
+    template<size_t index, typename K, typename V>
+    DTracker& Watch(const DMap<K, V>& map, const typename DMap<K, V>::Key& low, const typename DMap<K, V>::Key& high) {
+      static_assert(std::is_same<std::tuple_element_t<index, std::tuple<N...>>, std::map<K, V>>::value, "a range is watched as a std::map");
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(map.WatchedRange(low, high));
+      return *this;
+    }
+
+    template<size_t index, typename K, typename V>
+    DTracker& Watch(const DMap<K, V>& map) {
+      static_assert(std::is_same<std::tuple_element_t<index, std::tuple<N...>>, std::unordered_map<K, V>>::value, "a whole map is watched as a std::unordered_map");
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(map.items_);
+      return *this;
+    }
+
+    // The input at index is either a std::vector<E> or a VectorDelta<E>.
+    template<size_t index, typename E>
+    DTracker& Watch(const DVector<E>& vector) {
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Watch<index>(
+        vector.Watched(static_cast<const std::tuple_element_t<index, std::tuple<N...>>*>(nullptr))
+      );
+      return *this;
+    }
+
+    DTracker& Bind(const std::function<void(const T& value)>& bind_function) {
+      shared_block_->Bind(bind_function);
+      return *this;
+    }
+
+    // Keeps the results of up to capacity input combinations, with a copy of their inputs. A
+    // recalculation whose inputs equal those of a kept result by operator!= takes that result
+    // without calling the calculator. For pure calculators only. Hash hashes every input type,
+    // std::hash when void, it only has to spread the inputs. 0 stops memoizing.
+    template<typename Hash = void>
+    DTracker& Memoize(size_t capacity) {
+      std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+      shared_block_->template Memoize<Hash>(capacity);
+      return *this;
+    }
+
+    MemoStatistics CacheStatistics() const {
+      return shared_block_->CacheStatistics();
+    }
+
+    void Update() {
+      std::shared_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockShared();
+      shared_block_->Update();
+    }
+
+    void Apply() {
+      shared_block_->Apply();
+    }
+
+    T Value() {
+      detail::ReadCapture::Record(shared_block_->TrackedValue().get());
+      std::shared_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockShared();
+      return shared_block_->Value();
+    }
+
+    // A single load, any thread may ask without blocking.
+    bool IsValid() const {
+      return shared_block_->IsValid();
+    }
+
+    // Reads without copying. As for DValue the reference is not guarded in concurrent mode, other
+    // threads may recalculate the tracker while it is referenced.
+    const T& ValueRef() const {
+      detail::ReadCapture::Record(shared_block_->TrackedValue().get());
+      std::shared_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockShared();
+      return shared_block_->ValueRef();
+    }
+
+  private:
+    detail::NodeRef<detail::Tracker<T, N...>> shared_block_;
+  };
+
+  // A tracker whose calculator takes no inputs and reads DValue, DTracker and DAutoTracker values
+  // instead. Whatever a run read is watched until the next run, so an input read only on some
+  // branch stops invalidating the tracker once the branch is not taken. Reads of DVector and
+  // DMap are not recorded. Auto trackers are evaluated on the thread calling Apply, even with
+  // workers, and are not available in concurrent graphs.
+  template<typename T>
+  class DAutoTracker {
+  public:
+    template<typename R, typename... M>
+    friend class DTracker;
+    friend class DTrack::Snapshot;
+
+    // calculator is any callable taking nothing and returning a T, it is stored inline.
+    template<typename F>
+    DAutoTracker(const DTrack& global_block, F calculator)
+      : shared_block_(
+        detail::MakeNode<detail::AutoCalculatorTracker<F, T>>(
+          global_block.global_block_->Nodes(),
+          global_block.global_block_.get(),
+          std::move(calculator)
+        )
+      )
+    {
+
+    }
+
+    template<typename F>
+    DAutoTracker(const DTrack& global_block, const T& default_value, F calculator)
+      : shared_block_(
+        detail::MakeNode<detail::AutoCalculatorTracker<F, T>>(
+          global_block.global_block_->Nodes(),
+          global_block.global_block_.get(),
+          default_value,
+          std::move(calculator)
+        )
+      )
+    {
+
+    }
+
+    DAutoTracker(const DAutoTracker&) = default;
+
+    DAutoTracker(DAutoTracker&&) = default;
+
+    DAutoTracker& operator=(DAutoTracker another) {
+      std::swap(shared_block_, another.shared_block_);
+      return *this;
+    }
+
+    ~DAutoTracker() {
+      if (shared_block_) {
+        std::unique_lock<std::shared_timed_mutex> lock = shared_block_->Block()->LockExclusive();
+        shared_block_.reset();
+      }
+    }
+
+    DAutoTracker& Bind(const std::function<void(const T& value)>& bind_function) {
+      shared_block_->Bind(bind_function);
+      return *this;
+    }
+
+    void Update() {
+      shared_block_->Update();
+    }
+
+    void Apply() {
+      shared_block_->Apply();
+    }
+
+    T Value() {
+      detail::ReadCapture::Record(shared_block_->TrackedValue().get());
+      return shared_block_->Value();
+    }
+
+    bool IsValid() const {
+      return shared_block_->IsValid();
+    }
+
+    const T& ValueRef() const {
+      detail::ReadCapture::Record(shared_block_->TrackedValue().get());
+      return shared_block_->ValueRef();
+    }
+
+  private:
+    detail::NodeRef<detail::AutoTracker<T>> shared_block_;
+  };
+
+#if defined(__cpp_deduction_guides)
+  template<typename R, typename... A>
+  DTracker(const DTrack&, R(*)(A...)) -> DTracker<R, std::decay_t<A>...>;
+
+  template<typename R, typename... A>
+  DTracker(const DTrack&, const R&, R(*)(A...)) -> DTracker<R, std::decay_t<A>...>;
+
+  template<typename F>
+  DAutoTracker(const DTrack&, F) -> DAutoTracker<std::decay_t<decltype(std::declval<F&>()())>>;
+#endif
+
+  // Deduces the DTracker from the call operator of a lambda or function object, which a
+  // deduction guide can not spell.
+  template<typename F>
+  typename detail::CalculatorTraits<std::decay_t<F>>::Tracker MakeTracker(const DTrack& global_block, F&& calculator) {
+    return typename detail::CalculatorTraits<std::decay_t<F>>::Tracker(global_block, std::forward<F>(calculator));
+  }
+
+  template<typename F>
+  DAutoTracker<std::decay_t<decltype(std::declval<std::decay_t<F>&>()())>> MakeAutoTracker(const DTrack& global_block, F&& calculator) {
+    return DAutoTracker<std::decay_t<decltype(std::declval<std::decay_t<F>&>()())>>(global_block, std::forward<F>(calculator));
+  }
+
+  // The inputs a StaticNode reads, in the order its Calculate takes them.
+  template<typename... I>
+  struct StaticInputs {
+
+  };
+
+  // A value written from outside of a StaticGraph.
+  template<typename T>
+  struct StaticInput {
+    typedef T Value;
+    typedef StaticInputs<> Inputs;
+    typedef typename ChangePolicy<T>::type Policy;
+    static const bool kSource = true;
+  };
+
+  // A value computed from the nodes I... The deriving type provides
+  //   static T Calculate(const I::Value&... inputs);
+  // and may declare its own Policy.
+  template<typename T, typename... I>
+  struct StaticNode {
+    typedef T Value;
+    typedef StaticInputs<I...> Inputs;
+    typedef typename ChangePolicy<T>::type Policy;
+    static const bool kSource = false;
+  };
+
+  namespace detail
+  {
+    template<typename X, typename... Nodes>
+    constexpr size_t StaticIndex() {
+      const bool same[] = { false, std::is_same<X, Nodes>::value... };
+      for (size_t i = 1; i < sizeof(same) / sizeof(same[0]); ++i) {
+        if (same[i]) {
+          return i - 1;
         }
-        return std::make_tuple(false, 0);
       }
-    };
+      return sizeof...(Nodes);
+    }
 
+    // The order a StaticGraph updates its nodes in and which nodes read each of them, all
+    // computed at compile time. Bits are numbered by rank, inputs always rank below their readers.
     template<size_t N>
-    struct FirstSetBitReverse {
+    struct StaticLayout {
+      static const size_t kWords = (N + 63) / 64;
 
+      size_t rank[N];
+      size_t node[N];
+      // The direct readers of the node at each rank.
+      uint64_t readers[N][kWords];
+      // The nodes which are not sources.
+      uint64_t computed[kWords];
+      // Every input is one of the nodes.
+      bool closed;
+      bool acyclic;
     };
 
-    template<>
-    struct FirstSetBitReverse<sizeof(unsigned long)> {
-      std::tuple<bool, size_t> operator()(unsigned long value) {
-        unsigned long index;
-        if (_BitScanReverse(
-          &index,
-          value
-        )) {
-          return std::make_tuple(true, index);
+    template<typename... Nodes, size_t N, typename... I>
+    constexpr bool StaticEdges(bool (&reads)[N][N], size_t reader, StaticInputs<I...>*) {
+      const size_t inputs[] = { N, StaticIndex<I, Nodes...>()... };
+      for (size_t i = 1; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+        if (inputs[i] == N) {
+          return false;
         }
-        return std::make_tuple(false, 0);
+        reads[reader][inputs[i]] = true;
       }
-    };
+      return true;
+    }
 
-    template<>
-    struct FirstSetBitReverse<sizeof(unsigned __int64)> {
-      std::tuple<bool, size_t> operator()(unsigned __int64 value) {
-        unsigned long index;
-        if (_BitScanReverse64(
-          &index,
-          value
-        )) {
-          return std::make_tuple(true, index);
+    // Kahn's algorithm, the lowest node index first among the nodes which are ready.
+    template<typename... Nodes>
+    constexpr StaticLayout<sizeof...(Nodes)> BuildStaticLayout() {
+      const size_t n = sizeof...(Nodes);
+      StaticLayout<n> layout = {};
+      bool reads[n][n] = {};
+      const bool edges[] = { true, StaticEdges<Nodes...>(reads, StaticIndex<Nodes, Nodes...>(), static_cast<typename Nodes::Inputs*>(nullptr))... };
+      for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+        if (!edges[i]) {
+          return layout;
         }
-        return std::make_tuple(false, 0);
       }
-    };
-
-    class GlobalBlock;
-    class TrackerPosition;
-
-    struct PositionComparator {
-      bool operator() (
-        const std::tuple<size_t, uintptr_t>& lhs,
-        const std::tuple<size_t, uintptr_t>& rhs
-      ) const {
-        if (
-          (
-            std::get<1>(lhs)
-            ==
-            std::numeric_limits<std::tuple_element_t<1, std::tuple<size_t, uintptr_t>>>::max()
-          )
-          &&
-          (
-            std::get<1>(rhs)
-            ==
-            std::numeric_limits<std::tuple_element_t<1, std::tuple<size_t, uintptr_t>>>::max()
-          )
-        ) {
-          return std::get<0>(lhs) < std::get<1>(rhs);
+      layout.closed = true;
+      bool placed[n] = {};
+      size_t ranked = 0;
+      while (ranked < n) {
+        size_t ready = n;
+        for (size_t j = 0; j < n && ready == n; ++j) {
+          if (placed[j]) {
+            continue;
+          }
+          bool waiting = false;
+          for (size_t i = 0; i < n; ++i) {
+            waiting = waiting || (reads[j][i] && !placed[i]);
+          }
+          if (!waiting) {
+            ready = j;
+          }
         }
-
-        if (
-          (
-            std::get<1>(lhs)
-            ==
-            std::numeric_limits<std::tuple_element_t<1, std::tuple<size_t, uintptr_t>>>::max()
-          )
-          &&
-          (
-            std::get<1>(rhs)
-            !=
-            std::numeric_limits<std::tuple_element_t<1, std::tuple<size_t, uintptr_t>>>::max()
-          )
-        ) {
-          return false;
+        if (ready == n) {
+          return layout;
         }
-        if (
-          (
-            std::get<1>(lhs)
-            !=
-            std::numeric_limits<std::tuple_element_t<1, std::tuple<size_t, uintptr_t>>>::max()
-          )
-          &&
-          (
-            std::get<1>(rhs)
-            ==
-            std::numeric_limits<std::tuple_element_t<1, std::tuple<size_t, uintptr_t>>>::max()
-          )
-        ) {
-          return true;
+        placed[ready] = true;
+        layout.rank[ready] = ranked;
+        layout.node[ranked] = ready;
+        ++ranked;
+      }
+      const bool sources[] = { false, Nodes::kSource... };
+      for (size_t j = 0; j < n; ++j) {
+        for (size_t i = 0; i < n; ++i) {
+          if (reads[j][i]) {
+            layout.readers[layout.rank[i]][layout.rank[j] / 64] |= uint64_t(1) << (layout.rank[j] % 64);
+          }
+        }
+        if (!sources[j + 1]) {
+          layout.computed[layout.rank[j] / 64] |= uint64_t(1) << (layout.rank[j] % 64);
         }
-        return std::get<0>(lhs) < std::get<1>(rhs);
       }
-    };
+      layout.acyclic = true;
+      return layout;
+    }
+  }
 
-    class GlobalBlock {
-    public:
-      GlobalBlock()
-        : trackers_position_()
-        , trackers_validation_status_()
-        , trackers_() {
+  // A graph whose nodes and edges are types, for pipelines whose shape is fixed at compile time.
+  // Nodes derive from StaticInput or StaticNode and are listed in any order. The update order and
+  // the readers of every node are computed when compiling, a write only marks the readers of the
+  // written source and Update evaluates the marked nodes in one unrolled pass, marking the readers
+  // of the values which changed. Nothing is allocated and nothing is shared with a DTrack.
+  template<typename... Nodes>
+  class StaticGraph {
+  public:
+    static const size_t kNodeCount = sizeof...(Nodes);
+    static const size_t kWords = detail::StaticLayout<kNodeCount>::kWords;
 
+    StaticGraph()
+      : values_()
+      , policies_()
+      , dirty_() {
+      for (size_t i = 0; i < kWords; ++i) {
+        dirty_[i] = kLayout.computed[i];
       }
+    }
 
-      ~GlobalBlock() {
-
+    template<typename X>
+    void Set(const typename X::Value& value) {
+      static_assert(X::kSource, "only sources are written");
+      const size_t index = Index<X>();
+      if (Assign<index>(value)) {
+        MarkReaders(kLayout.rank[index]);
       }
+    }
 
-      GlobalBlock(const GlobalBlock&) = delete;
-
-      GlobalBlock& operator=(const GlobalBlock& another) = delete;
-
-      std::shared_ptr<TrackerPosition> AllocatePosition(const std::function<void()>& invalidate_handler);
+    template<typename X>
+    void Set(typename X::Value&& value) {
+      static_assert(X::kSource, "only sources are written");
+      const size_t index = Index<X>();
+      if (Assign<index>(std::move(value))) {
+        MarkReaders(kLayout.rank[index]);
+      }
+    }
 
-      void FreePosition(const std::shared_ptr<TrackerPosition>& position);
+    bool IsValid() const {
+      uint64_t dirty = 0;
+      for (size_t i = 0; i < kWords; ++i) {
+        dirty |= dirty_[i];
+      }
+      return !dirty;
+    }
 
-      void Apply();
+    void Update() {
+      UpdateRanks(std::make_index_sequence<kNodeCount>{});
+    }
 
-      void CommitValidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position);
+    template<typename X>
+    typename X::Value Value() {
+      return ValueRef<X>();
+    }
 
-      void CommitInvalidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position);
+    template<typename X>
+    const typename X::Value& ValueRef() {
+      if (!IsValid()) {
+        Update();
+      }
+      return std::get<Index<X>()>(values_);
+    }
 
-      bool IsPositionValid(const std::tuple<size_t, uintptr_t>& tracker_position) const;
+  private:
+    template<typename X>
+    static constexpr size_t Index() {
+      static_assert(detail::StaticIndex<X, Nodes...>() < kNodeCount, "the node is not part of the graph");
+      return detail::StaticIndex<X, Nodes...>();
+    }
 
-    private:
-      std::set<std::tuple<size_t, uintptr_t>, PositionComparator> trackers_position_;
-      std::vector<uintptr_t> trackers_validation_status_;
-      std::unordered_map<size_t, std::array<std::shared_ptr<TrackerPosition>, sizeof(uintptr_t) * CHAR_BIT>> trackers_;
-    };
+    static constexpr detail::StaticLayout<sizeof...(Nodes)> kLayout = detail::BuildStaticLayout<Nodes...>();
+    static_assert(kLayout.closed, "every input of a static node is one of the nodes of its graph");
+    static_assert(!kLayout.closed || kLayout.acyclic, "static graphs can not have cycles");
 
-    template<typename T>
-    class Trackable {
-    public:
-      Trackable(const std::shared_ptr<GlobalBlock>& global_block)
-        : value_()
-        , global_block_(global_block)
-        , tracked_positions_() {
+    template<size_t index, typename V>
+    bool Assign(V&& value) {
+      typename std::tuple_element_t<index, std::tuple<Nodes...>>::Value& stored = std::get<index>(values_);
+      if (!std::get<index>(policies_).Changed(stored, value)) {
+        return false;
+      }
+      stored = std::forward<V>(value);
+      return true;
+    }
 
+    void MarkReaders(size_t rank) {
+      for (size_t i = 0; i < kWords; ++i) {
+        dirty_[i] |= kLayout.readers[rank][i];
       }
+    }
 
-      Trackable(const std::shared_ptr<GlobalBlock>& global_block, const T& default_value)
-        : value_(default_value)
-        , global_block_(global_block)
-        , tracked_positions_() {
+    template<size_t... R>
+    void UpdateRanks(std::index_sequence<R...>) {
+      int updated[] = { 0, (UpdateRank<R>(), 0)... };
+      (void)updated;
+    }
 
+    template<size_t rank>
+    void UpdateRank() {
+      const uint64_t bit = uint64_t(1) << (rank % 64);
+      if (!(dirty_[rank / 64] & bit)) {
+        return;
       }
-
-      void Invalidate() {
-        std::unordered_map<size_t, uintptr_t>::iterator it = tracked_positions_.begin();
-        for (; it != tracked_positions_.end(); ++it) {
-          global_block_->CommitInvalidatedPosition(*it);
-        }
+      dirty_[rank / 64] &= ~bit;
+      const size_t index = kLayout.node[rank];
+      typedef std::tuple_element_t<index, std::tuple<Nodes...>> Node;
+      if (Evaluate<index>(std::integral_constant<bool, Node::kSource>(), static_cast<typename Node::Inputs*>(nullptr))) {
+        MarkReaders(rank);
       }
+    }
 
-      void Track(const std::tuple<size_t, uintptr_t>& position) {
-        CheckBit(std::get<1>(position));
-        std::unordered_map<size_t, uintptr_t>::iterator it = tracked_positions_.find(std::get<0>(position));
-        if (it == tracked_positions_.end()) {
-          tracked_positions_.emplace(std::get<0>(position), std::get<1>(position)).first;
-          return;
-        }
-        it->second = it->second | std::get<1>(position);
-      }
+    // Sources are never marked.
+    template<size_t index, typename... I>
+    bool Evaluate(std::true_type, StaticInputs<I...>*) {
+      return false;
+    }
 
-      void StopTrack(const std::tuple<size_t, uintptr_t>& position) {
-        CheckBit(std::get<1>(position));
-        std::unordered_map<size_t, uintptr_t>::iterator it = tracked_positions_.find(std::get<0>(position));
-        assert(it != tracked_positions_.end());
-        it->second = it->second & (~std::get<1>(position));
-      }
+    template<size_t index, typename... I>
+    bool Evaluate(std::false_type, StaticInputs<I...>*) {
+      typedef std::tuple_element_t<index, std::tuple<Nodes...>> Node;
+      return Assign<index>(Node::Calculate(std::get<detail::StaticIndex<I, Nodes...>()>(values_)...));
+    }
 
-      T Value() const { return value_; }
+    std::tuple<typename Nodes::Value...> values_;
+    std::tuple<typename Nodes::Policy...> policies_;
+    uint64_t dirty_[kWords];
+  };
 
-      const T& ValueRef() const { return value_; }
+  template<typename... Nodes>
+  constexpr detail::StaticLayout<sizeof...(Nodes)> StaticGraph<Nodes...>::kLayout;
+#if defined(DTRACK_USE_COROUTINES)
+  // Takes a piece of work and runs it, on any thread and at any later time.
+  typedef std::function<void(std::function<void()> work)> AsyncExecutor;
 
-      void SetValue(const T& new_value) {
-        if (value_ != new_value) {
-          value_ = new_value;
-          Invalidate();
-        }
-      }
+  // Queues the posted work until RunPending runs it on the calling thread. The executor for async
+  // trackers of a single threaded graph, which has to be written from the thread owning it.
+  class AsyncQueue {
+  public:
+    AsyncQueue()
+      : mutex_()
+      , work_() {
 
-    private:
-      T value_;
-      std::shared_ptr<GlobalBlock> global_block_;
-      std::unordered_map<size_t, uintptr_t> tracked_positions_;
-    };
+    }
 
-    class TrackerPosition {
-    public:
-      TrackerPosition(const std::tuple<size_t, uintptr_t>& position, std::function<void()> invalidate_handler)
-        : invalidate_handler_(invalidate_handler)
-        , position_(position) {
+    AsyncQueue(const AsyncQueue&) = delete;
 
-      }
+    AsyncQueue& operator=(const AsyncQueue&) = delete;
 
-      void NotifyInvalidated() {
-        invalidate_handler_();
+    AsyncExecutor Executor() {
+      return [this] (std::function<void()> work) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        work_.push_back(std::move(work));
+      };
+    }
+
+    // Work posted meanwhile waits for the next call. Returns how many were run.
+    size_t RunPending() {
+      std::vector<std::function<void()>> work;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        work.swap(work_);
       }
+      for (size_t i = 0; i < work.size(); ++i) {
+        work[i]();
+      }
+      return work.size();
+    }
 
-      std::tuple<size_t, uintptr_t> Position() const { return position_; }
+  private:
+    std::mutex mutex_;
+    std::vector<std::function<void()>> work_;
+  };
 
-    private:
-      std::function<void()> invalidate_handler_;
-      std::tuple<size_t, uintptr_t> position_;
-    };
+  // Tells a running calculation whether a later launch has superseded it, its result would be
+  // dropped anyway.
+  class CancelToken {
+  public:
+    CancelToken(std::shared_ptr<const std::atomic<uint64_t>> launched, uint64_t generation)
+      : launched_(std::move(launched))
+      , generation_(generation) {
 
-    template<typename R, typename... T>
-    R InvokeImpl(
-      const std::function<R(const T&...)>& function,
-      const std::shared_ptr<Trackable<T>>&... args
-    ) {
-      return function((args ? args->ValueRef() : T())...);
     }
 
-    template <typename R, typename... T, std::size_t... I>
-    R ExpandInvoke(
-      const std::function<R(const T&...)>& function,
-      const std::tuple<std::shared_ptr<Trackable<T>>...>& arguments,
-      std::index_sequence<I...>
-    ) {
-      return InvokeImpl<R, T...>(
-        function,
-        std::get<I>(arguments)...
-      );
+    bool Cancelled() const {
+      return launched_->load(std::memory_order_acquire) != generation_;
     }
 
-    template<typename R, typename... T>
-    R Invoke(
-      const std::function<R(const T&...)>& function,
-      const std::tuple<std::shared_ptr<Trackable<T>>...>& arguments
-    ) {
-      return ExpandInvoke(
-        function,
-        arguments,
-        std::index_sequence_for<T...>{}
-      );
-    }
+  private:
+    std::shared_ptr<const std::atomic<uint64_t>> launched_;
+    uint64_t generation_;
+  };
 
-    template<typename T>
-    void Noop(const T&) {
+  template<typename T>
+  class Task;
 
-    }
+  template<typename T, typename... N>
+  class AsyncDTracker;
 
-    template<typename T, typename... N>
-    class Tracker {
-    public:
-      Tracker(
-        const std::shared_ptr<GlobalBlock>& global_block,
-        const std::function<T(const N&...)>& calculator
-      )
-        : tracked_value_(std::make_shared<Trackable<T>>(global_block))
-        , global_block_(global_block)
-        , position_(global_block->AllocatePosition(std::bind(std::mem_fn(&Tracker::NotifyInvalidated), this)))
-        , tracking_values_()
-        , calculator_(calculator)
-        , bind_function_(&Noop<T>) {
+  namespace detail
+  {
+    // Shared by an async tracker and the coroutines it launched, which may outlive it.
+    template<typename T>
+    struct AsyncState {
+      explicit AsyncState(AsyncExecutor async_executor)
+        : launched(0)
+        , delivered(0)
+        , executor(std::move(async_executor))
+        , mutex()
+        , delivery_finished()
+        , result()
+        , bind_function()
+        , pending()
+        , pending_generation(0)
+        , delivering() {
 
       }
 
-      Tracker(
-        const std::shared_ptr<GlobalBlock>& global_block,
-        const T& default_value,
-        const std::function<T(const N&...)>& calculator
-      )
-        : tracked_value_(std::make_shared<Trackable<T>>(global_block, default_value))
-        , global_block_(global_block)
-        , position_(global_block->AllocatePosition(std::bind(std::mem_fn(&Tracker::NotifyInvalidated), this)))
-        , tracking_values_()
-        , calculator_(calculator)
-        , bind_function_(&Noop<T>){
-
+      // Only the result of the latest launch is kept. One thread at a time delivers, outside the
+      // lock, so that the result and the callback may bind, launch again or destroy the tracker.
+      // A result completed meanwhile waits for that thread, which delivers it next. A launch counts
+      // as delivered once its value is set, Ready never reports a value which is not there yet.
+      void Complete(uint64_t generation, T&& value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (generation != launched.load(std::memory_order_acquire) || !result) {
+          return;
+        }
+        pending.emplace(std::move(value));
+        pending_generation = generation;
+        if (delivering != std::thread::id()) {
+          return;
+        }
+        delivering = std::this_thread::get_id();
+        while (pending && result) {
+          T delivered_value = std::move(*pending);
+          uint64_t delivered_generation = pending_generation;
+          pending.reset();
+          std::shared_ptr<DValue<T>> delivered_result = result;
+          std::function<void(const T&)> callback = bind_function;
+          lock.unlock();
+          delivered_result->SetValue(std::move(delivered_value));
+          delivered.store(delivered_generation, std::memory_order_release);
+          if (callback) {
+            callback(delivered_result->ValueRef());
+          }
+          callback = nullptr;
+          delivered_result.reset();
+          lock.lock();
+        }
+        pending.reset();
+        delivering = std::thread::id();
+        delivery_finished.notify_all();
       }
 
-      ~Tracker() {
-        global_block_->FreePosition(position_);
+      // Called by the tracker going away, after which nothing is delivered to it. Waits for a
+      // delivery on another thread, one on this thread is calling back into the destructor.
+      void Detach() {
+        std::unique_lock<std::mutex> lock(mutex);
+        result.reset();
+        bind_function = nullptr;
+        delivery_finished.wait(
+          lock,
+          [this] () { return delivering == std::thread::id() || delivering == std::this_thread::get_id(); }
+        );
       }
 
-      bool IsValid() const {
-        return global_block_->IsPositionValid(position_->Position());
-      }
+      std::atomic<uint64_t> launched;
+      std::atomic<uint64_t> delivered;
+      AsyncExecutor executor;
+      // Guards the members below against the tracker going away.
+      std::mutex mutex;
+      std::condition_variable delivery_finished;
+      std::shared_ptr<DValue<T>> result;
+      std::function<void(const T&)> bind_function;
+      std::optional<T> pending;
+      uint64_t pending_generation;
+      std::thread::id delivering;
+    };
+
+    template<typename F, typename T, typename... N>
+    class AsyncLauncher;
+
+    // Owns a coroutine which has not started, destroying it unless it was resumed.
+    struct TaskFrame {
+      explicit TaskFrame(std::coroutine_handle<> frame_handle)
+        : handle(frame_handle) {
 
-      void NotifyInvalidated() {
-        Apply();
       }
 
-      template<size_t index>
-      void Watch(const std::shared_ptr<Trackable<std::tuple_element_t<index, std::tuple<N...>>>>& value) {
-        if (std::get<index>(tracking_values_)) {
-          std::get<index>(tracking_values_)->StopTrack(position_->Position());
+      ~TaskFrame() {
+        if (handle) {
+          handle.destroy();
         }
-        std::get<index>(tracking_values_) = value;
-        value->Track(position_->Position());
       }
 
-      void Update() {
-        tracked_value_->SetValue(Invoke<T, N...>(calculator_, tracking_values_));
-        global_block_->CommitValidatedPosition(position_->Position());
-      }
+      TaskFrame(const TaskFrame&) = delete;
 
-      void Bind(const std::function<void (const T&)>& bind_function) {
-        bind_function_ = bind_function;
-      }
+      TaskFrame& operator=(const TaskFrame&) = delete;
 
-      void Apply() {
-        bind_function_(tracked_value_->ValueRef());
-      }
+      std::coroutine_handle<> handle;
+    };
+  }
 
-      T Value() {
-        if (!IsValid()) {
-          Update();
-        }
-        return tracked_value_->Value();
-      }
+  // What the calculator of an AsyncDTracker returns. It starts suspended and is resumed on the
+  // executor of its tracker, its co_return value is delivered when it finishes.
+  template<typename T>
+  class Task {
+  private:
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
 
-      const T& ValueRef() const {
-        if (!IsValid()) {
-          Update();
-        }
-        return tracked_value_->ValueRef();
+      template<typename P>
+      void await_suspend(std::coroutine_handle<P> handle) noexcept {
+        P& promise = handle.promise();
+        std::shared_ptr<detail::AsyncState<T>> state = std::move(promise.state);
+        uint64_t generation = promise.generation;
+        std::optional<T> value = std::move(promise.value);
+        handle.destroy();
+        state->Complete(generation, std::move(*value));
       }
 
-    private:
-      std::shared_ptr<Trackable<T>> tracked_value_;
-      std::shared_ptr<GlobalBlock> global_block_;
-      std::shared_ptr<TrackerPosition> position_;
-      std::tuple<std::shared_ptr<Trackable<N>>...> tracking_values_;
-      std::function<T(const N&...)> calculator_;
-      std::function<void(const T&)> bind_function_;
+      void await_resume() noexcept {}
     };
 
-    std::shared_ptr<TrackerPosition> GlobalBlock::AllocatePosition(
-      const std::function<void()>& invalidate_handler
-    ) {
-      if (trackers_position_.empty()) {
-        assert(trackers_.empty());
-        std::tuple<size_t, uintptr_t> position_allocated;
-        std::get<0>(position_allocated) = 0;
-        std::get<1>(position_allocated) = 1;
-        std::shared_ptr<TrackerPosition> new_tracker_position =
-          std::make_shared<TrackerPosition>(position_allocated, invalidate_handler);
-        trackers_position_.emplace(0, 1);
-        std::array<std::shared_ptr<TrackerPosition>, sizeof(uintptr_t) * CHAR_BIT> tracker_container;
-        tracker_container[0] = new_tracker_position;
-        trackers_.emplace(0, tracker_container);
-        return new_tracker_position;
-      }
-      std::tuple<size_t, uintptr_t> first_tracker_position = *(trackers_position_.begin());
-      if (
-        std::get<1>(first_tracker_position)
-        ==
-        std::numeric_limits<
-          std::tuple_element_t<
-            1,
-            std::tuple<size_t, uintptr_t>
-          >
-        >::max()
-      ) {
-        size_t available = 0;
-        if (std::get<0>(first_tracker_position) > 0) {
-          available = 0;
-        } else {
-          std::set<std::tuple<size_t, uintptr_t>, PositionComparator>::iterator
-            left = trackers_position_.begin();
-          std::set<std::tuple<size_t, uintptr_t>, PositionComparator>::iterator
-            right = left;
-          std::advance(right, 1);
-          while (right != trackers_position_.end()) {
-            if (std::get<0>(*right) - std::get<0>(*left) != 1) {
-              break;
-            }
-            std::advance(left, 1);
-            std::advance(right, 1);
-          }
-          available = std::get<0>(*left) + 1;
-        }
-        std::tuple<size_t, uintptr_t> position_allocated;
-        std::get<0>(position_allocated) = available;
-        std::get<1>(position_allocated) = 1;
-        std::shared_ptr<TrackerPosition> new_tracker_position =
-          std::make_shared<TrackerPosition>(position_allocated, invalidate_handler);
-        trackers_position_.insert(position_allocated);
-        std::array<std::shared_ptr<TrackerPosition>, sizeof(uintptr_t)* CHAR_BIT> new_trackers;
-        new_trackers[0] = new_tracker_position;
-        trackers_.emplace(std::get<0>(position_allocated), new_trackers);
-        return new_tracker_position;
-      }
-      uintptr_t already_occupied_position = std::get<1>(first_tracker_position);
-      trackers_position_.erase(trackers_position_.begin());
-      trackers_position_.emplace(std::get<0>(first_tracker_position), (already_occupied_position << 1) | 1);
-      std::tuple<size_t, uintptr_t> position_allocated;
-      std::get<0>(position_allocated) = std::get<0>(first_tracker_position);
-      std::get<1>(position_allocated) = already_occupied_position + 1;
-      std::shared_ptr<TrackerPosition> new_tracker_position =
-        std::make_shared<TrackerPosition>(position_allocated, invalidate_handler);
-      FirstSetBitReverse<sizeof(uintptr_t)> scaner;
-      std::tuple<bool, size_t> bit_position = scaner(std::get<1>(position_allocated));
-      assert(std::get<0>(bit_position));
-      trackers_[std::get<0>(position_allocated)][std::get<1>(bit_position)] = new_tracker_position;
-      return new_tracker_position;
-    }
-
-    void GlobalBlock::FreePosition(const std::shared_ptr<TrackerPosition>& tracker) {
-      std::tuple<size_t, uintptr_t> position = tracker->Position();
-      assert(CheckBit(std::get<1>(position)));
-      std::tuple<size_t, uintptr_t> lower_bound = position;
-      std::get<1>(lower_bound) = std::numeric_limits<uintptr_t>::min();
-      std::set<std::tuple<size_t, uintptr_t>, PositionComparator>::iterator it_position =
-        trackers_position_.upper_bound(lower_bound);
-      assert(it_position != trackers_position_.end());
-      if (std::get<0>(*it_position) != std::get<0>(position)) {
-        std::tuple<size_t, uintptr_t> exact_tracker_position = position;
-        std::get<1>(exact_tracker_position) = std::numeric_limits<uintptr_t>::max();
-        it_position = trackers_position_.find(exact_tracker_position);
-      }
-      assert(it_position != trackers_position_.end());
-      std::tuple<size_t, uintptr_t> current_trackers_position = *it_position;
-      trackers_position_.erase(it_position);
-      std::get<1>(current_trackers_position) =
-        std::get<1>(current_trackers_position) & (~std::get<1>(position));
-      bool is_all_tracker_removed = std::get<1>(current_trackers_position) == 0;
-      if (!is_all_tracker_removed) {
-        trackers_position_.insert(current_trackers_position);
-      }
-      if (std::get<0>(position) < trackers_validation_status_.size()) {
-        trackers_validation_status_[std::get<0>(position)] =
-          trackers_validation_status_[std::get<0>(position)]
-          &
-          (~std::get<1>(position));
-      }
-      std::unordered_map<size_t, std::array<std::shared_ptr<TrackerPosition>, sizeof(uintptr_t)* CHAR_BIT>>::iterator
-        it_tracker = trackers_.find(std::get<0>(position));
-      assert(it_tracker != trackers_.end());
-      FirstSetBitForward<sizeof(uintptr_t)> scaner;
-      std::tuple<bool, size_t> bit_position = scaner(std::get<1>(position));
-      assert(std::get<0>(bit_position));
-      trackers_[std::get<0>(position)][std::get<1>(bit_position)].reset();
-      if (is_all_tracker_removed) {
-        trackers_.erase(it_tracker);
-      }
-    }
-
-    void GlobalBlock::Apply() {
-
-    }
-
-    void GlobalBlock::CommitValidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position) {
-      assert(CheckBit(std::get<1>(tracker_position)));
-      if (std::get<0>(tracker_position) >= trackers_validation_status_.size()) {
-        return;
-      }
-      trackers_validation_status_[std::get<0>(tracker_position)] =
-        trackers_validation_status_[std::get<0>(tracker_position)] & (~std::get<1>(tracker_position));
-    }
+  public:
+    struct promise_type {
+      promise_type()
+        : value()
+        , state()
+        , generation(0) {
 
-    void GlobalBlock::CommitInvalidatedPosition(const std::tuple<size_t, uintptr_t>& tracker_position) {
-      if (trackers_validation_status_.size() <= std::get<0>(tracker_position)) {
-        trackers_validation_status_.resize(std::get<0>(tracker_position) + 1, 0);
       }
-      trackers_validation_status_[std::get<0>(tracker_position)] =
-        trackers_validation_status_[std::get<0>(tracker_position)] | std::get<1>(tracker_position);
-    }
 
-    bool GlobalBlock::IsPositionValid(const std::tuple<size_t, uintptr_t>& tracker_position) const {
-      if (std::get<0>(tracker_position) >= trackers_validation_status_.size()) {
-        return true;
+      Task get_return_object() {
+        return Task(std::coroutine_handle<promise_type>::from_promise(*this));
       }
-      assert(CheckBit(std::get<1>(tracker_position)));
-      return trackers_validation_status_.at(std::get<0>(tracker_position)) ^ std::get<1>(tracker_position);
-    }
 
-    template<typename T>
-    T Argument(const T& value) {
-      return value;
-    }
-  }
+      std::suspend_always initial_suspend() noexcept { return {}; }
 
-  class DTrack {
-  public:
-    template<typename T>
-    friend class DValue;
-    template<typename T, typename... N>
-    friend class DTracker;
+      FinalAwaiter final_suspend() noexcept { return {}; }
 
-  public:
-    DTrack()
-      : global_block_(std::make_shared<detail::GlobalBlock>()) {
+      void return_value(T result) {
+        value = std::move(result);
+      }
 
-    }
+      void unhandled_exception() {
+        std::terminate();
+      }
+
+      std::optional<T> value;
+      std::shared_ptr<detail::AsyncState<T>> state;
+      uint64_t generation;
+    };
+
+    Task(Task&& another) noexcept
+      : handle_(std::exchange(another.handle_, {})) {
 
-    void Apply() {
-      global_block_->Apply();
     }
 
-  private:
-    std::shared_ptr<detail::GlobalBlock> global_block_;
-  };
+    Task(const Task&) = delete;
 
-  template<typename T>
-  class DValue {
-  public:
-    DValue(const DTrack& global_block)
-      : tracked_value_(std::make_shared<detail::Trackable<T>>(global_block.global_block_)) {
+    Task& operator=(const Task&) = delete;
 
+    ~Task() {
+      if (handle_) {
+        handle_.destroy();
+      }
     }
 
-    DValue(const DTrack& global_block, const T& default_value)
-      : tracked_value_(std::make_shared<detail::Trackable<T>>(global_block.global_block_, default_value)) {
+  private:
+    template<typename F, typename R, typename... M>
+    friend class detail::AsyncLauncher;
 
-    }
+    explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {
 
-    void SetValue(T value) {
-      tracked_value_->SetValue(value);
     }
 
-    T Value() { return tracked_value_->Value(); }
-
-    const T& ValueRef() const { return tracked_value_->ValueRef(); }
+    // Hands the coroutine to the executor. A launch superseded before the executor runs it is
+    // destroyed without starting.
+    void Start(const std::shared_ptr<detail::AsyncState<T>>& state, uint64_t generation) {
+      handle_.promise().state = state;
+      handle_.promise().generation = generation;
+      std::shared_ptr<detail::TaskFrame> frame = std::make_shared<detail::TaskFrame>(std::exchange(handle_, {}));
+      std::weak_ptr<detail::AsyncState<T>> weak_state = state;
+      state->executor(
+        [frame, weak_state, generation] () {
+          std::shared_ptr<detail::AsyncState<T>> state = weak_state.lock();
+          if (!state || state->launched.load(std::memory_order_acquire) != generation) {
+            return;
+          }
+          std::exchange(frame->handle, {}).resume();
+        }
+      );
+    }
 
-  public:
-    std::shared_ptr<detail::Trackable<T>> tracked_value_;
+    std::coroutine_handle<promise_type> handle_;
   };
 
-  template<typename T>
-  class DVector {
-  public:
+  namespace detail
+  {
+    // The calculator of the tracker behind an AsyncDTracker, it launches a coroutine per call and
+    // returns its generation. The calculator of the coroutines is stored inline.
+    template<typename F, typename T, typename... N>
+    class AsyncLauncher {
+    public:
+      AsyncLauncher(std::shared_ptr<AsyncState<T>> state, F calculator)
+        : state_(std::move(state))
+        , calculator_(std::move(calculator)) {
 
+      }
 
-  private:
+      uint64_t operator()(const N&... inputs) {
+        uint64_t generation = state_->launched.fetch_add(1, std::memory_order_acq_rel) + 1;
+        Task<T> task = calculator_(CancelToken(std::shared_ptr<const std::atomic<uint64_t>>(state_, &state_->launched), generation), inputs...);
+        task.Start(state_, generation);
+        return generation;
+      }
 
-  };
+    private:
+      std::shared_ptr<AsyncState<T>> state_;
+      F calculator_;
+    };
+  }
 
+  // A tracker whose calculator is a coroutine. Whenever the inputs changed, by the next Apply or
+  // Update in pull mode and by the write itself in push mode, a new calculation is launched on
+  // the executor and the running one is superseded: it is dropped before starting, can see it
+  // through its CancelToken, and its result is discarded. The result of the latest launch is
+  // written to Result, which other trackers may watch, and handed to the bound callback, both
+  // on the thread finishing the coroutine or on one still delivering an earlier result. The
+  // callback may bind, launch again or destroy the tracker. A single threaded graph needs an executor running
+  // the work on the thread owning the graph, such as AsyncQueue; a concurrent graph may finish
+  // them anywhere but the executor must not run work inline.
   template<typename T, typename... N>
-  class DTracker {
+  class AsyncDTracker {
   public:
-    DTracker(const DTrack& global_block, const std::function<T(const N&...)>& calculator)
-      : shared_block_(std::make_shared<detail::Tracker<T, N...>>(global_block.global_block_, calculator))
-    {
-
+    // calculator is called as calculator(CancelToken, N... inputs) and returns a Task<T>. It
+    // runs after the call returns, so it takes its inputs by value. The captures of a lambda live
+    // in the tracker, a coroutine still running once the tracker is gone must not touch them.
+    template<typename F>
+    AsyncDTracker(const DTrack& global_block, AsyncExecutor executor, F calculator)
+      : state_(std::make_shared<detail::AsyncState<T>>(std::move(executor)))
+      , launcher_(global_block, detail::AsyncLauncher<F, T, N...>(state_, std::move(calculator))) {
+      state_->result = std::make_shared<DValue<T>>(global_block);
     }
 
-    DTracker(const DTrack& global_block, const T& default_value, const std::function<T(const N&...)>& calculator)
-      : shared_block_(std::make_shared<detail::Tracker<T, N...>>(global_block.global_block_, default_value, calculator))
-    {
+    AsyncDTracker(AsyncDTracker&&) = default;
 
-    }
+    AsyncDTracker& operator=(AsyncDTracker&&) = delete;
 
-    template<size_t index>
-    DTracker& Watch(const DValue<std::tuple_element_t<index, std::tuple<N...>>>& value) {
-      shared_block_->Watch<index>(value.tracked_value_);
-      return *this;
+    // Supersedes the running calculation, its coroutine may finish later without delivering.
+    ~AsyncDTracker() {
+      if (state_) {
+        state_->launched.fetch_add(1, std::memory_order_acq_rel);
+        state_->Detach();
+      }
     }
 
-    template<size_t index>
-    DTracker& Watch(const DTracker<std::tuple_element_t<index, std::tuple<N...>>>& tracker) {
-      shared_block_->Watch<index>(tracker.tracked_value_);
+    // Takes anything a DTracker watches at index.
+    template<size_t index, typename... A>
+    AsyncDTracker& Watch(const A&... watched) {
+      launcher_.template Watch<index>(watched...);
       return *this;
     }
 
-    template<size_t index>
-    DTracker& Bind(std::function<void(const T& value)>) {
+    AsyncDTracker& Bind(const std::function<void(const T& value)>& bind_function) {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->bind_function = bind_function;
       return *this;
     }
 
+    // Launches a calculation when the inputs changed since the last one.
     void Update() {
-      shared_block_->Update();
+      launcher_.Update();
     }
 
-    void Apply() {
-      shared_block_->Apply();
+    // The inputs changed since the last launch or its result has not arrived yet.
+    bool Pending() const {
+      return !launcher_.IsValid()
+        || state_->delivered.load(std::memory_order_acquire) != state_->launched.load(std::memory_order_acquire);
     }
 
-    T Value() {
-      return shared_block_->Value();
+    bool Ready() const {
+      return !Pending();
     }
 
-    const T& ValueRef() const {
-      return shared_block_->ValueRef();
+    // The latest result delivered, default constructed before the first.
+    T Value() const {
+      return state_->result->Value();
+    }
+
+    const DValue<T>& Result() const {
+      return *state_->result;
     }
 
   private:
-    std::shared_ptr<detail::Tracker<T, N...>> shared_block_;
+    std::shared_ptr<detail::AsyncState<T>> state_;
+    DTracker<uint64_t, N...> launcher_;
   };
+#endif
 }
 
 #endif // DTRACK_
@@ -1,5 +1,10 @@
 #include "BaseDefine.h"
+#include <cstdio>
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <chrono>
 #include "catch.hpp"
 #include "dtrack.h"
 
@@ -46,8 +51,1576 @@ TEST_CASE("Test several value and several trackers bind") {
   CHECK(tracker_1.Value().second == 0);
 }
 
+TEST_CASE("Test invalidation propagates through tracker chains") {
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 1);
+  dtrack::DTracker<int, int> first(global, &Calculator);
+  dtrack::DTracker<int, int> second(global, &Calculator);
+  dtrack::DTracker<int, int, int> sum(
+    global,
+    [] (const int& lhs, const int& rhs) -> int {
+      return lhs + rhs;
+    }
+  );
+  first.Watch<0>(source);
+  second.Watch<0>(first);
+  sum.Watch<0>(first).Watch<1>(second);
+  CHECK(sum.Value() == 5);
+  source.SetValue(10);
+  CHECK(second.Value() == 12);
+  CHECK(sum.Value() == 23);
+  source.SetValue(20);
+  CHECK(sum.Value() == 43);
+  CHECK(first.Value() == 21);
+  dtrack::DTracker<int, int, int> twice(
+    global,
+    [] (const int& lhs, const int& rhs) -> int {
+      return lhs * rhs;
+    }
+  );
+  twice.Watch<0>(source).Watch<1>(source);
+  twice.Watch<0>(first);
+  source.SetValue(3);
+  CHECK(twice.Value() == 12);
+}
+
+TEST_CASE("Test apply recalculates a diamond once per tracker") {
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 1);
+  int calculations = 0;
+  std::function<int(const int&)> counted = [&calculations] (const int& input) -> int {
+    ++calculations;
+    return input + 1;
+  };
+  dtrack::DTracker<int, int> base(global, counted);
+  dtrack::DTracker<int, int> left(global, counted);
+  dtrack::DTracker<int, int> right(global, counted);
+  dtrack::DTracker<int, int, int> bottom(
+    global,
+    [&calculations] (const int& lhs, const int& rhs) -> int {
+      ++calculations;
+      return lhs * rhs;
+    }
+  );
+  bottom.Watch<0>(left).Watch<1>(right);
+  left.Watch<0>(base);
+  base.Watch<0>(source);
+  right.Watch<0>(source);
+  std::vector<int> applied;
+  bottom.Bind([&applied] (const int& value) { applied.push_back(value); });
+  global.Apply();
+  CHECK(calculations == 4);
+  CHECK(applied == std::vector<int>{ 6 });
+  source.SetValue(2);
+  source.SetValue(3);
+  global.Apply();
+  CHECK(calculations == 8);
+  CHECK(applied == std::vector<int>{ 6, 20 });
+  global.Apply();
+  CHECK(calculations == 8);
+  CHECK(bottom.Value() == 20);
+}
+
+TEST_CASE("Test apply evaluates wide heights on worker threads") {
+  dtrack::DTrack global;
+  global.SetWorkerCount(4);
+  dtrack::DValue<int> source(global, 1);
+  std::vector<std::unique_ptr<dtrack::DTracker<int, int>>> first_level;
+  std::vector<std::unique_ptr<dtrack::DTracker<int, int, int>>> second_level;
+  for (int i = 0; i < 100; ++i) {
+    first_level.emplace_back(
+      new dtrack::DTracker<int, int>(global, [i] (const int& input) { return input * i; })
+    );
+    first_level.back()->Watch<0>(source);
+  }
+  for (int i = 0; i < 99; ++i) {
+    second_level.emplace_back(
+      new dtrack::DTracker<int, int, int>(global, [] (const int& lhs, const int& rhs) { return lhs + rhs; })
+    );
+    second_level.back()->Watch<0>(*first_level[i]).Watch<1>(*first_level[i + 1]);
+  }
+  global.Apply();
+  source.SetValue(3);
+  global.Apply();
+  for (int i = 0; i < 99; ++i) {
+    CHECK(second_level[i]->Value() == 3 * (2 * i + 1));
+  }
+}
+
+TEST_CASE("Test worker threads see inputs a callback invalidated") {
+  dtrack::DTrack global;
+  global.SetWorkerCount(4);
+  dtrack::DValue<int> x(global, 0);
+  // Slow enough that every worker would reach a while another one is still updating it.
+  dtrack::DTracker<int, int> a(global, [] (const int& input) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return input * 2;
+  });
+  a.Watch<0>(x);
+  // In pull mode the write leaves a invalid while the drain moves on to its watchers.
+  a.Bind([&x] (const int& value) {
+    if (value % 4 == 0) {
+      x.SetValue(x.Value() + 1);
+    }
+  });
+  std::vector<std::unique_ptr<dtrack::DTracker<int, int>>> watchers;
+  for (int i = 0; i < 64; ++i) {
+    watchers.emplace_back(new dtrack::DTracker<int, int>(global, [i] (const int& input) { return input + i; }));
+    watchers.back()->Watch<0>(a);
+  }
+  for (int round = 1; round <= 4; ++round) {
+    x.SetValue(round * 2);
+    global.Apply();
+    CHECK(x.Value() == round * 2 + 1);
+    CHECK(a.IsValid());
+    for (int i = 0; i < 64; ++i) {
+      CHECK(watchers[i]->IsValid());
+      CHECK(watchers[i]->Value() == (round * 2 + 1) * 2 + i);
+    }
+  }
+}
+
+TEST_CASE("Test push mode recalculates on writes") {
+  dtrack::DTrack global;
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  dtrack::DValue<int> source(global, 1);
+  dtrack::DValue<int> echo(global, 0);
+  int calculations = 0;
+  std::function<int(const int&)> counted = [&calculations] (const int& input) -> int {
+    ++calculations;
+    return input + 1;
+  };
+  dtrack::DTracker<int, int> left(global, counted);
+  dtrack::DTracker<int, int> right(global, counted);
+  dtrack::DTracker<int, int> deep(global, counted);
+  dtrack::DTracker<int, int, int> bottom(
+    global,
+    [&calculations] (const int& lhs, const int& rhs) -> int {
+      ++calculations;
+      return lhs + rhs;
+    }
+  );
+  left.Watch<0>(source);
+  deep.Watch<0>(left);
+  right.Watch<0>(source);
+  bottom.Watch<0>(deep).Watch<1>(right);
+  dtrack::DTracker<int, int> echoed(global, counted);
+  echoed.Watch<0>(echo);
+  std::vector<int> pushed;
+  bottom.Bind([&pushed, &echo] (const int& value) {
+    pushed.push_back(value);
+    echo.SetValue(value);
+  });
+  global.Apply();
+  CHECK(pushed == std::vector<int>{ 5 });
+  CHECK(calculations == 6);
+  source.SetValue(2);
+  CHECK(pushed == std::vector<int>{ 5, 7 });
+  CHECK(calculations == 11);
+  CHECK(echoed.Value() == 8);
+  CHECK(calculations == 11);
+  global.SetUpdateMode(dtrack::UpdateMode::Pull);
+  source.SetValue(3);
+  CHECK(pushed == std::vector<int>{ 5, 7 });
+  CHECK(bottom.Value() == 9);
+}
+
+TEST_CASE("Test callbacks replacing trackers of their level notify only the old ones") {
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 1);
+  dtrack::DTracker<int, int> first(global, [] (const int& input) { return input + 1; });
+  std::unique_ptr<dtrack::DTracker<int, int>> second(new dtrack::DTracker<int, int>(global, [] (const int& input) { return input + 2; }));
+  std::unique_ptr<dtrack::DTracker<int, int>> replacement;
+  int replacement_notified = 0;
+  first.Watch<0>(source);
+  second->Watch<0>(source);
+  // The replacement takes the slot of the tracker it replaces, which is still to be notified.
+  first.Bind([&] (const int&) {
+    second.reset();
+    replacement.reset(new dtrack::DTracker<int, int>(global, [] (const int& input) { return input + 3; }));
+    replacement->Watch<0>(source);
+    replacement->Bind([&replacement_notified] (const int&) { ++replacement_notified; });
+  });
+  global.Apply();
+  CHECK(replacement_notified == 0);
+  CHECK(replacement->Value() == 4);
+}
+
+TEST_CASE("Test unchanged trackers cut recalculation off") {
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 20);
+  int calculations = 0;
+  std::function<int(const int&)> counted = [&calculations] (const int& input) -> int {
+    ++calculations;
+    return input + 1;
+  };
+  dtrack::DTracker<int, int> clamp(global, [] (const int& input) { return std::min(input, 10); });
+  dtrack::DTracker<int, int> first(global, counted);
+  dtrack::DTracker<int, int> second(global, counted);
+  clamp.Watch<0>(source);
+  first.Watch<0>(clamp);
+  second.Watch<0>(first);
+  std::vector<int> clamped;
+  clamp.Bind([&clamped] (const int& value) { clamped.push_back(value); });
+  CHECK(second.Value() == 12);
+  CHECK(calculations == 2);
+  dtrack::UpdateStatistics before = global.Statistics();
+  source.SetValue(30);
+  CHECK(second.Value() == 12);
+  CHECK(calculations == 2);
+  CHECK(global.Statistics().recomputations == before.recomputations + 1);
+  CHECK(global.Statistics().cutoffs == before.cutoffs + 2);
+  source.SetValue(40);
+  global.Apply();
+  CHECK(calculations == 2);
+  CHECK(global.Statistics().cutoffs == before.cutoffs + 4);
+  // The clamp recalculated to the same value, it only calls back once it changes.
+  CHECK(clamped.empty());
+  source.SetValue(5);
+  global.Apply();
+  CHECK(calculations == 4);
+  CHECK(second.Value() == 7);
+  CHECK(clamped == std::vector<int>{5});
+}
+
+TEST_CASE("Test transactions invalidate once at commit") {
+  dtrack::DTrack global;
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  dtrack::DValue<int> lhs(global, 1);
+  dtrack::DValue<int> rhs(global, 2);
+  dtrack::DTracker<int, int, int> sum(global, [] (const int& left, const int& right) { return left + right; });
+  sum.Watch<0>(lhs).Watch<1>(rhs);
+  std::vector<int> pushed;
+  sum.Bind([&pushed] (const int& value) { pushed.push_back(value); });
+  global.Apply();
+  CHECK(pushed == std::vector<int>{ 3 });
+  {
+    dtrack::DTrack::Transaction transaction(global);
+    lhs.SetValue(10);
+    lhs.SetValue(20);
+    {
+      dtrack::DTrack::Transaction nested(global);
+      rhs.SetValue(30);
+    }
+    CHECK(pushed == std::vector<int>{ 3 });
+    CHECK(lhs.Value() == 20);
+    {
+      dtrack::DValue<int> dropped(global, 0);
+      dtrack::DTracker<int, int> unused(global, &Calculator);
+      unused.Watch<0>(dropped);
+      dropped.SetValue(1);
+    }
+  }
+  CHECK(pushed == std::vector<int>{ 3, 50 });
+  CHECK(sum.Value() == 50);
+}
+
+TEST_CASE("Test concurrent graphs take writes and edits from other threads") {
+  const size_t writer_count = 4;
+  const size_t values_per_writer = 16;
+  const int writes = 2000;
+  dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+  std::vector<dtrack::DValue<int>> values;
+  std::vector<dtrack::DTracker<int, int>> doubled;
+  for (size_t i = 0; i < writer_count * values_per_writer; ++i) {
+    values.emplace_back(global, 0);
+    doubled.emplace_back(global, [] (const int& value) { return value * 2; });
+    doubled.back().Watch<0>(values.back());
+  }
+  dtrack::DTracker<int, int, int> sum(global, [] (const int& lhs, const int& rhs) { return lhs + rhs; });
+  sum.Watch<0>(doubled.front()).Watch<1>(doubled.back());
+  global.Apply();
+  std::atomic<size_t> running(writer_count + 1);
+  std::vector<std::thread> threads;
+  for (size_t writer = 0; writer < writer_count; ++writer) {
+    threads.emplace_back(
+      [&, writer] () {
+        for (int round = 1; round <= writes; ++round) {
+          for (size_t i = 0; i < values_per_writer; ++i) {
+            values[writer * values_per_writer + i].SetValue(round);
+          }
+        }
+        --running;
+      }
+    );
+  }
+  // Builds and drops trackers on the values the writers are writing.
+  threads.emplace_back(
+    [&] () {
+      for (int round = 0; round < writes; ++round) {
+        dtrack::DTracker<int, int> reader(global, [] (const int& value) { return value + 1; });
+        reader.Watch<0>(values[round % values.size()]);
+      }
+      --running;
+    }
+  );
+  // Every value only grows, so what the reader sees must only grow as well.
+  std::vector<int> seen(doubled.size(), 0);
+  bool consistent = true;
+  while (running > 0) {
+    global.Apply();
+    for (size_t i = 0; i < doubled.size(); ++i) {
+      int value = doubled[i].Value();
+      consistent = consistent && value % 2 == 0 && value >= seen[i];
+      seen[i] = value;
+    }
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  CHECK(consistent);
+  global.Apply();
+  for (size_t i = 0; i < doubled.size(); ++i) {
+    CHECK(doubled[i].IsValid());
+    CHECK(doubled[i].Value() == 2 * writes);
+  }
+  CHECK(sum.Value() == 4 * writes);
+  std::thread([&] () { values.front().SetValue(writes + 1); }).join();
+  CHECK(!sum.IsValid());
+  CHECK(sum.Value() == 4 * writes + 2);
+}
+
+TEST_CASE("Test concurrent writes during an evaluation invalidate the tracker again") {
+  const int rounds = 200;
+  dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+  dtrack::DValue<int> x(global, 0);
+  dtrack::DTracker<int, int> doubled(global, [] (const int& value) { return value * 2; });
+  doubled.Watch<0>(x);
+  bool interleave = false;
+  dtrack::DTracker<int, int> shifted(global, [&x, &interleave] (const int& value) {
+    // The writer propagates its write while the reader evaluates with the value of doubled from
+    // before the write.
+    if (interleave) {
+      std::thread([&x] () { x.tracked_value_->Publish(); }).join();
+    }
+    return value + 1;
+  });
+  shifted.Watch<0>(doubled);
+  bool consistent = true;
+  for (int round = 1; round <= rounds; ++round) {
+    // Leaves doubled valid and shifted invalid.
+    x.SetValue(round * 2 - 1);
+    doubled.Value();
+    // Assigns as SetValue does, the propagation is left to the writer shifted starts.
+    {
+      std::unique_lock<std::shared_timed_mutex> lock = x.tracked_value_->Block()->LockExclusive();
+      x.tracked_value_->ModifyUnpublished(
+        [round] (int& value) {
+          value = round * 2;
+          return true;
+        }
+      );
+    }
+    interleave = true;
+    shifted.Value();
+    interleave = false;
+    consistent = consistent && shifted.Value() == round * 4 + 1;
+  }
+  CHECK(consistent);
+
+  // The same with a writer running freely.
+  const int writes = 20000;
+  std::thread writer(
+    [&x] () {
+      for (int write = rounds * 2 + 1; write <= rounds * 2 + writes; ++write) {
+        x.SetValue(write);
+      }
+    }
+  );
+  int seen = 0;
+  for (int read = 0; read < writes; ++read) {
+    int value = shifted.Value();
+    consistent = consistent && value % 2 == 1 && value >= seen;
+    seen = value;
+  }
+  writer.join();
+  CHECK(consistent);
+  CHECK(shifted.Value() == (rounds * 2 + writes) * 2 + 1);
+}
+
+struct LiveCounted {
+  LiveCounted() : value(0) { ++live; }
+  LiveCounted(int initial) : value(initial) { ++live; }
+  LiveCounted(const LiveCounted& another) : value(another.value) { ++live; }
+  ~LiveCounted() { --live; }
+  LiveCounted& operator=(const LiveCounted& another) = default;
+  bool operator!=(const LiveCounted& another) const { return value != another.value; }
+  int value;
+  static int live;
+};
+
+int LiveCounted::live = 0;
+
+// Debug builds also assert that no node is left once the graph goes away.
+TEST_CASE("Test handles of concurrent graphs are copied and dropped on any thread") {
+  const size_t thread_count = 4;
+  const int rounds = 2000;
+  dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+  dtrack::DValue<int> value(global, 1);
+  dtrack::DTracker<int, int> tracker(global, [] (const int& input) { return input + 1; });
+  tracker.Watch<0>(value);
+  dtrack::DVector<int> items(global, std::vector<int>(thread_count, 0));
+  dtrack::DTracker<size_t, dtrack::VectorDelta<int>> size(global, [] (const dtrack::VectorDelta<int>& delta) { return delta.Items().size(); });
+  size.Watch<0>(items);
+  global.Apply();
+  std::atomic<size_t> running(thread_count);
+  std::vector<std::thread> threads;
+  for (size_t thread = 0; thread < thread_count; ++thread) {
+    threads.emplace_back(
+      [&, thread] () {
+        dtrack::DValue<int> value_copy(value);
+        dtrack::DTracker<int, int> tracker_copy(tracker);
+        for (int round = 0; round < rounds; ++round) {
+          value_copy = value;
+          tracker_copy = tracker;
+          dtrack::DVector<int> items_copy(items);
+          items_copy.Set(thread, round);
+          // The last references of these are dropped here, while the other threads apply.
+          dtrack::DValue<int> own(global, round);
+          dtrack::DTracker<int, int> watcher(tracker_copy);
+          watcher = dtrack::DTracker<int, int>(global, [] (const int& input) { return input; });
+          watcher.Watch<0>(own);
+        }
+        --running;
+      }
+    );
+  }
+  while (running > 0) {
+    global.Apply();
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  CHECK(tracker.Value() == 2);
+  CHECK(items.Value() == std::vector<int>(thread_count, rounds - 1));
+
+  // Trackers watching the delta keep the elements alive past the vector.
+  {
+    dtrack::DVector<int> gone(global, std::vector<int>{1, 2, 3});
+    size.Watch<0>(gone);
+  }
+  CHECK(size.Value() == 3);
+}
+
+TEST_CASE("Test snapshots keep the epoch they pinned") {
+  dtrack::DTrack global;
+  global.EnableSnapshots();
+  dtrack::DValue<LiveCounted> source(global, LiveCounted(1));
+  dtrack::DTracker<int, LiveCounted> negated(global, [] (const LiveCounted& input) { return -input.value; });
+  negated.Watch<0>(source);
+  {
+    dtrack::DTrack::Snapshot empty(global);
+    CHECK(empty.Read(source).value == 0);
+    CHECK(empty.Read(negated) == 0);
+  }
+  global.Apply();
+  std::unique_ptr<dtrack::DTrack::Snapshot> first(new dtrack::DTrack::Snapshot(global));
+  CHECK(first->Read(source).value == 1);
+  CHECK(first->Read(negated) == -1);
+  source.SetValue(LiveCounted(2));
+  source.SetValue(LiveCounted(3));
+  global.Apply();
+  int live_before = LiveCounted::live;
+  {
+    dtrack::DTrack::Snapshot second(global);
+    CHECK(second.Epoch() > first->Epoch());
+    CHECK(second.Read(source).value == 3);
+    CHECK(second.Read(negated) == -3);
+    CHECK(first->Read(source).value == 1);
+    CHECK(first->Read(negated) == -1);
+    source.SetValue(LiveCounted(4));
+    global.Apply();
+    CHECK(second.Read(source).value == 3);
+    CHECK(LiveCounted::live == live_before + 1);
+  }
+  // Nothing reads the version of the second snapshot any more, but the first snapshot may be
+  // walking past it.
+  global.Apply();
+  CHECK(first->Read(source).value == 1);
+  CHECK(LiveCounted::live == live_before + 1);
+  first.reset();
+  global.Apply();
+  CHECK(LiveCounted::live == live_before - 1);
+}
+
+TEST_CASE("Test snapshots past the reader slots wait for one to go away") {
+  dtrack::DTrack global;
+  global.EnableSnapshots();
+  dtrack::DValue<int> source(global, 1);
+  global.Apply();
+  std::vector<std::unique_ptr<dtrack::DTrack::Snapshot>> pinned;
+  for (size_t i = 0; i < dtrack::detail::GlobalBlock::kReaderSlots; ++i) {
+    pinned.emplace_back(new dtrack::DTrack::Snapshot(global));
+  }
+  std::atomic<int> read(0);
+  std::thread reader(
+    [&global, &source, &read] () {
+      dtrack::DTrack::Snapshot snapshot(global);
+      read = snapshot.Read(source);
+    }
+  );
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK(read == 0);
+  pinned.pop_back();
+  reader.join();
+  CHECK(read == 1);
+}
+
+TEST_CASE("Test snapshots of vector deltas keep the elements of their epoch") {
+  dtrack::DTrack global;
+  global.EnableSnapshots();
+  dtrack::DVector<int> items(global, std::vector<int>{1, 2, 3});
+  auto doubled = dtrack::MakeTracker(global, dtrack::MakeIncrementalMap<int>([] (const int& item) { return item * 2; }));
+  doubled.Watch<0>(items);
+  global.Apply();
+  dtrack::DTrack::Snapshot snapshot(global);
+  const dtrack::VectorDelta<int>& pinned = snapshot.Read(doubled);
+  uint64_t revision = pinned.Revision();
+  CHECK(pinned.Items() == std::vector<int>{2, 4, 6});
+
+  // The incremental map edits its output in place.
+  items.Set(0, 10);
+  items.PushBack(4);
+  global.Apply();
+  CHECK(doubled.Value().Items() == std::vector<int>{20, 4, 6, 8});
+  CHECK(pinned.Items() == std::vector<int>{2, 4, 6});
+  CHECK(pinned.Revision() == revision);
+  size_t changes = 0;
+  CHECK(pinned.ForEachChangeSince(revision, [&changes] (const dtrack::VectorChange&) { ++changes; }));
+  CHECK(changes == 0);
+}
+
+TEST_CASE("Test snapshots stay consistent while the graph is applied") {
+  const int rounds = 2000;
+  const size_t reader_count = 3;
+  dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+  global.EnableSnapshots();
+  dtrack::DValue<int> source(global, 0);
+  dtrack::DTracker<int, int> negated(global, [] (const int& input) { return -input; });
+  dtrack::DTracker<int, int, int> sum(global, [] (const int& lhs, const int& rhs) { return lhs + rhs; });
+  negated.Watch<0>(source);
+  sum.Watch<0>(source).Watch<1>(negated);
+  global.Apply();
+  std::atomic<bool> running(true);
+  std::atomic<size_t> inconsistent(0);
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < reader_count; ++i) {
+    readers.emplace_back(
+      [&] () {
+        int last_read = 0;
+        while (running) {
+          dtrack::DTrack::Snapshot snapshot(global);
+          int value = snapshot.Read(source);
+          if (snapshot.Read(negated) != -value || snapshot.Read(sum) != 0 || value < last_read) {
+            ++inconsistent;
+          }
+          last_read = value;
+        }
+      }
+    );
+  }
+  for (int round = 1; round <= rounds; ++round) {
+    source.SetValue(round);
+    global.Apply();
+  }
+  running = false;
+  for (size_t i = 0; i < readers.size(); ++i) {
+    readers[i].join();
+  }
+  CHECK(inconsistent == 0);
+  dtrack::DTrack::Snapshot last(global);
+  CHECK(last.Read(negated) == -rounds);
+}
+
+// Keeps the doubles of a DVector<int> from its delta, recalculating only the written elements.
+struct DoubledMirror {
+  std::vector<int> operator()(const dtrack::VectorDelta<int>& delta) {
+    const std::vector<int>& items = delta.Items();
+    bool incremental = delta.ForEachChangeSince(revision, [this] (const dtrack::VectorChange& change) {
+      switch (change.kind) {
+      case dtrack::VectorChange::Insert:
+        doubled.insert(doubled.begin() + change.first, change.count, 0);
+        dirty.insert(dirty.begin() + change.first, change.count, 1);
+        break;
+      case dtrack::VectorChange::Erase:
+        doubled.erase(doubled.begin() + change.first, doubled.begin() + change.first + change.count);
+        dirty.erase(dirty.begin() + change.first, dirty.begin() + change.first + change.count);
+        break;
+      case dtrack::VectorChange::Update:
+        std::fill(dirty.begin() + change.first, dirty.begin() + change.first + change.count, 1);
+        break;
+      }
+    });
+    if (!incremental) {
+      ++rebuilds;
+      doubled.assign(items.size(), 0);
+      dirty.assign(items.size(), 1);
+    }
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (dirty[i]) {
+        doubled[i] = items[i] * 2;
+        dirty[i] = 0;
+        ++recalculated;
+      }
+    }
+    revision = delta.Revision();
+    return doubled;
+  }
+
+  uint64_t revision = 0;
+  std::vector<int> doubled;
+  std::vector<char> dirty;
+  int rebuilds = 0;
+  int recalculated = 0;
+};
+
+TEST_CASE("Test vector trackers follow the writes through the delta") {
+  dtrack::DTrack global;
+  dtrack::DVector<int> items(global, std::vector<int>{1, 2, 3});
+  dtrack::DTracker<int, std::vector<int>> sum(global, [] (const std::vector<int>& input) {
+    int total = 0;
+    for (int item : input) {
+      total += item;
+    }
+    return total;
+  });
+  sum.Watch<0>(items);
+  DoubledMirror mirror;
+  dtrack::DTracker<std::vector<int>, dtrack::VectorDelta<int>> doubled(global, std::ref(mirror));
+  doubled.Watch<0>(items);
+  CHECK(sum.Value() == 6);
+  CHECK(doubled.Value() == std::vector<int>{2, 4, 6});
+  CHECK(mirror.rebuilds == 1);
+
+  items.Set(1, 5);
+  items.PushBack(7);
+  items.Insert(0, 10);
+  items.Erase(2);
+  CHECK(items.Value() == std::vector<int>{10, 1, 3, 7});
+  CHECK(!sum.IsValid());
+  CHECK(sum.Value() == 21);
+  mirror.recalculated = 0;
+  CHECK(doubled.Value() == std::vector<int>{20, 2, 6, 14});
+  CHECK(mirror.rebuilds == 1);
+  CHECK(mirror.recalculated == 2);
+
+  // A drain brought every watcher up to date, the journal restarts after it.
+  global.Apply();
+  items.Modify(1, 2, [] (int& item) { item += 100; });
+  mirror.recalculated = 0;
+  global.Apply();
+  CHECK(doubled.Value() == std::vector<int>{20, 202, 206, 14});
+  CHECK(mirror.recalculated == 2);
+  CHECK(mirror.rebuilds == 1);
+
+  // A watcher left behind by a restart rebuilds.
+  DoubledMirror late;
+  dtrack::DTracker<std::vector<int>, dtrack::VectorDelta<int>> late_doubled(global, std::ref(late));
+  late_doubled.Watch<0>(items);
+  late.revision = 1;
+  CHECK(late_doubled.Value() == std::vector<int>{20, 202, 206, 14});
+  CHECK(late.rebuilds == 1);
+
+  // Many writes between two reads restart the journal too.
+  std::vector<int> expected = items.Value();
+  for (int i = 0; i < 100; ++i) {
+    items.Set(static_cast<size_t>(i % 4), i);
+    expected[static_cast<size_t>(i % 4)] = i;
+  }
+  CHECK(doubled.Value() == std::vector<int>{expected[0] * 2, expected[1] * 2, expected[2] * 2, expected[3] * 2});
+  CHECK(mirror.rebuilds == 2);
+
+  items.Assign(std::vector<int>{4, 5});
+  CHECK(sum.Value() == 9);
+  CHECK(doubled.Value() == std::vector<int>{8, 10});
+  CHECK(mirror.rebuilds == 2);
+}
+
+TEST_CASE("Test vector deltas mark the written chunks dirty") {
+  const size_t chunk = dtrack::VectorDelta<int>::kChunkSize;
+  dtrack::DTrack global;
+  dtrack::DVector<int> items(global, std::vector<int>(chunk * 100, 1));
+  std::vector<size_t> dirty;
+  dtrack::DTracker<size_t, dtrack::VectorDelta<int>> chunks(global, [&dirty] (const dtrack::VectorDelta<int>& delta) {
+    dirty.clear();
+    delta.ForEachDirtyChunk([&dirty] (size_t chunk) { dirty.push_back(chunk); });
+    return dirty.size();
+  });
+  chunks.Watch<0>(items);
+  CHECK(chunks.Value() == 0);
+  items.Set(chunk * 3 + 1, 2);
+  items.Modify(chunk * 70 - 1, 2, [] (int& item) { item = 3; });
+  CHECK(chunks.Value() == 3);
+  CHECK(dirty == std::vector<size_t>{3, 69, 70});
+  items.Erase(chunk * 98);
+  CHECK(chunks.Value() == 5);
+  CHECK(dirty == std::vector<size_t>{3, 69, 70, 98, 99});
+  global.Apply();
+  items.PushBack(5);
+  CHECK(chunks.Value() == 1);
+  CHECK(dirty == std::vector<size_t>{99});
+}
+
+TEST_CASE("Test incremental trackers match a full recalculation") {
+  dtrack::DTrack global;
+  dtrack::DVector<int> items(global, std::vector<int>{5, 3, 8, 1});
+  int mapped = 0;
+  auto tripled = dtrack::MakeTracker(global, dtrack::MakeIncrementalMap<int>([&mapped] (const int& item) {
+    ++mapped;
+    return item * 3;
+  }));
+  tripled.Watch<0>(items);
+  auto even = dtrack::MakeTracker(global, dtrack::MakeIncrementalFilter<int>([] (const int& item) { return item % 2 == 0; }));
+  even.Watch<0>(tripled);
+  auto sorted = dtrack::MakeTracker(global, dtrack::IncrementalSort<int>());
+  sorted.Watch<0>(even);
+  auto sum = dtrack::MakeTracker(global, dtrack::MakeIncrementalReduce(std::plus<int>(), 0));
+  sum.Watch<0>(tripled);
+  // Associative but not commutative, the first element which is not 0.
+  auto first = dtrack::MakeTracker(global, dtrack::MakeIncrementalReduce([] (const int& lhs, const int& rhs) { return lhs ? lhs : rhs; }, 0));
+  first.Watch<0>(items);
+
+  std::vector<int> expected = items.Value();
+  auto check = [&] () {
+    std::vector<int> expected_tripled;
+    std::vector<int> expected_even;
+    int expected_sum = 0;
+    int expected_first = 0;
+    for (int item : expected) {
+      expected_tripled.push_back(item * 3);
+      expected_sum += item * 3;
+      if (item * 3 % 2 == 0) {
+        expected_even.push_back(item * 3);
+      }
+      if (!expected_first) {
+        expected_first = item;
+      }
+    }
+    std::vector<int> expected_sorted = expected_even;
+    std::sort(expected_sorted.begin(), expected_sorted.end());
+    return tripled.Value().Items() == expected_tripled
+      && even.Value().Items() == expected_even
+      && sorted.Value().Items() == expected_sorted
+      && sum.Value() == expected_sum
+      && first.Value() == expected_first;
+  };
+  CHECK(check());
+
+  mapped = 0;
+  items.Set(2, 4);
+  expected[2] = 4;
+  CHECK(check());
+  CHECK(mapped == 1);
+
+  std::mt19937 random(3);
+  bool consistent = true;
+  mapped = 0;
+  size_t total_size = 0;
+  for (int round = 0; round < 500; ++round) {
+    int writes = std::uniform_int_distribution<int>(1, round % 50 == 0 ? 200 : 4)(random);
+    for (int i = 0; i < writes; ++i) {
+      int value = std::uniform_int_distribution<int>(0, 20)(random);
+      size_t size = expected.size();
+      switch (std::uniform_int_distribution<int>(0, size > 0 ? 4 : 1)(random)) {
+      case 0:
+      case 1: {
+        size_t position = std::uniform_int_distribution<size_t>(0, size)(random);
+        items.Insert(position, value);
+        expected.insert(expected.begin() + position, value);
+        break;
+      }
+      case 2: {
+        size_t position = std::uniform_int_distribution<size_t>(0, size - 1)(random);
+        size_t count = std::min<size_t>(size - position, std::uniform_int_distribution<size_t>(1, 3)(random));
+        items.Erase(position, count);
+        expected.erase(expected.begin() + position, expected.begin() + position + count);
+        break;
+      }
+      case 3: {
+        size_t position = std::uniform_int_distribution<size_t>(0, size - 1)(random);
+        items.Set(position, value);
+        expected[position] = value;
+        break;
+      }
+      default: {
+        size_t position = std::uniform_int_distribution<size_t>(0, size - 1)(random);
+        size_t count = std::min<size_t>(size - position, 5);
+        items.Modify(position, count, [value] (int& item) { item += value; });
+        for (size_t j = position; j < position + count; ++j) {
+          expected[j] += value;
+        }
+        break;
+      }
+      }
+    }
+    if (round % 3 == 0) {
+      global.Apply();
+    }
+    consistent = consistent && check();
+    total_size += expected.size();
+  }
+  CHECK(consistent);
+  CHECK(expected.size() > 50);
+  // Most rounds only map their writes.
+  CHECK(static_cast<size_t>(mapped) * 4 < total_size);
+}
+
+TEST_CASE("Test map watchers are invalidated by their keys only") {
+  dtrack::DTrack global;
+  dtrack::DMap<std::string, int> table(global, std::unordered_map<std::string, int>{{"a", 1}, {"b", 2}, {"d", 4}});
+  int key_evaluations = 0;
+  dtrack::DTracker<int, int> a(global, [&key_evaluations] (const int& value) {
+    ++key_evaluations;
+    return value;
+  });
+  a.Watch<0>(table, "a");
+  dtrack::DTracker<int, int> c(global, [] (const int& value) { return value; });
+  c.Watch<0>(table, "c");
+  int range_evaluations = 0;
+  dtrack::DTracker<int, std::map<std::string, int>> b_to_d(global, [&range_evaluations] (const std::map<std::string, int>& values) {
+    ++range_evaluations;
+    int sum = 0;
+    for (const std::pair<const std::string, int>& value : values) {
+      sum += value.second;
+    }
+    return sum;
+  });
+  b_to_d.Watch<0>(table, "b", "d");
+  dtrack::DTracker<size_t, std::unordered_map<std::string, int>> size(global, [] (const std::unordered_map<std::string, int>& values) {
+    return values.size();
+  });
+  size.Watch<0>(table);
+  global.Apply();
+  CHECK(a.Value() == 1);
+  CHECK(c.Value() == 0);
+  CHECK(b_to_d.Value() == 2);
+  CHECK(size.Value() == 3);
+
+  table.Set("d", 40);
+  CHECK(a.IsValid());
+  CHECK(c.IsValid());
+  CHECK(b_to_d.IsValid());
+  CHECK(!size.IsValid());
+  table.Set("c", 3);
+  CHECK(a.IsValid());
+  CHECK(!c.IsValid());
+  CHECK(!b_to_d.IsValid());
+  CHECK(c.Value() == 3);
+  CHECK(b_to_d.Value() == 5);
+  CHECK(size.Value() == 4);
+  table.Set("a", 1);
+  CHECK(a.IsValid());
+  table.Set("a", 10);
+  table.Erase("b");
+  global.Apply();
+  CHECK(a.Value() == 10);
+  CHECK(b_to_d.Value() == 3);
+  CHECK(size.Value() == 3);
+  CHECK(key_evaluations == 2);
+  CHECK(range_evaluations == 3);
+  CHECK(table.Value("b") == 0);
+  CHECK(!table.Contains("b"));
+
+  // A key nothing watches any more is dropped by its next write, watching it again starts over.
+  c = dtrack::DTracker<int, int>(global, [] (const int& value) { return -value; });
+  table.Set("c", 30);
+  c.Watch<0>(table, "c");
+  CHECK(c.Value() == -30);
+  table.Erase("c");
+  CHECK(c.Value() == 0);
+}
+
+TEST_CASE("Test map writes reach the ranges holding their key only") {
+  const int key_count = 64;
+  dtrack::DTrack global;
+  dtrack::DMap<int, int> table(global);
+  // Nested, overlapping, adjacent and empty ranges, some sharing ends.
+  const std::vector<std::pair<int, int>> bounds = {
+    {0, 64}, {0, 8}, {8, 16}, {4, 12}, {10, 11}, {20, 40}, {30, 50}, {30, 40}, {5, 5}, {16, 8}, {63, 64}
+  };
+  auto sum = [] (const std::map<int, int>& values) {
+    int total = 0;
+    for (const std::pair<const int, int>& value : values) {
+      total += value.second;
+    }
+    return total;
+  };
+  std::vector<dtrack::DTracker<int, std::map<int, int>>> sums;
+  for (size_t i = 0; i < bounds.size(); ++i) {
+    sums.emplace_back(global, sum);
+    sums.back().Watch<0>(table, bounds[i].first, bounds[i].second);
+  }
+  std::vector<int> expected(key_count, 0);
+  auto check = [&] () {
+    for (size_t i = 0; i < bounds.size(); ++i) {
+      int total = 0;
+      for (int key = bounds[i].first; key < bounds[i].second; ++key) {
+        total += expected[key];
+      }
+      CHECK(sums[i].Value() == total);
+    }
+  };
+  std::mt19937 random(7);
+  for (int round = 0; round < 500; ++round) {
+    global.Apply();
+    int key = static_cast<int>(random() % key_count);
+    // Every key present holds a value other than 0, erasing a missing key changes nothing.
+    bool changed = true;
+    if (round % 5 == 4) {
+      changed = expected[key] != 0;
+      table.Erase(key);
+      expected[key] = 0;
+    } else {
+      expected[key] = round + 1;
+      table.Set(key, round + 1);
+    }
+    for (size_t i = 0; i < bounds.size(); ++i) {
+      bool holding = bounds[i].first <= key && key < bounds[i].second;
+      CHECK(sums[i].IsValid() != (changed && holding));
+    }
+    if (round % 50 == 0) {
+      check();
+    }
+  }
+  check();
+
+  // Ranges nothing watches any more are dropped by the writes inside them, then watched anew.
+  for (size_t i = 0; i < bounds.size(); i += 2) {
+    sums[i] = dtrack::DTracker<int, std::map<int, int>>(global, sum);
+  }
+  for (int key = 0; key < key_count; ++key) {
+    expected[key] = -key;
+    table.Set(key, -key);
+  }
+  for (size_t i = 0; i < bounds.size(); i += 2) {
+    sums[i].Watch<0>(table, bounds[i].first, bounds[i].second);
+  }
+  check();
+  table.Set(30, 1);
+  expected[30] = 1;
+  check();
+
+  // Empty and inverted ranges share one value which no write reaches.
+  dtrack::DTracker<int, std::map<int, int>> inverted(global, sum);
+  inverted.Watch<0>(table, 40, 20);
+  CHECK(inverted.Value() == 0);
+  table.Set(30, 2);
+  CHECK(inverted.IsValid());
+  CHECK(sums[8].IsValid());
+  CHECK(sums[9].IsValid());
+}
+
+TEST_CASE("Test auto trackers watch only the values they read last") {
+  dtrack::DTrack global;
+  dtrack::DValue<bool> use_a(global, true);
+  dtrack::DValue<int> a(global, 1);
+  dtrack::DValue<int> b(global, 2);
+  int evaluations = 0;
+  dtrack::DAutoTracker<int> pick(global, [&] () {
+    ++evaluations;
+    return use_a.Value() ? a.Value() : b.Value();
+  });
+  CHECK(!pick.IsValid());
+  CHECK(pick.Value() == 1);
+  b.SetValue(5);
+  CHECK(pick.IsValid());
+  a.SetValue(3);
+  CHECK(pick.Value() == 3);
+  CHECK(evaluations == 2);
+
+  use_a.SetValue(false);
+  CHECK(pick.Value() == 5);
+  a.SetValue(7);
+  CHECK(pick.IsValid());
+  CHECK(evaluations == 3);
+
+  // Auto trackers read static trackers and are watched by them.
+  dtrack::DTracker<int, int> doubled(global, [] (const int& value) { return value * 2; });
+  doubled.Watch<0>(pick);
+  dtrack::DAutoTracker<int> chain = dtrack::MakeAutoTracker(global, [&doubled] () { return doubled.Value() + 1; });
+  CHECK(chain.Value() == 11);
+  b.SetValue(10);
+  CHECK(!chain.IsValid());
+  CHECK(chain.Value() == 21);
+  CHECK(evaluations == 4);
+
+  // The inputs are checked in the order they were read, a changed condition is found before
+  // the input it no longer needs is recalculated.
+  int squares = 0;
+  dtrack::DTracker<int, int> square(global, [&squares] (const int& value) {
+    ++squares;
+    return value * value;
+  });
+  square.Watch<0>(a);
+  dtrack::DAutoTracker<int> lazy(global, [&] () { return use_a.Value() ? square.Value() : 0; });
+  use_a.SetValue(true);
+  CHECK(lazy.Value() == 49);
+  a.SetValue(8);
+  use_a.SetValue(false);
+  CHECK(lazy.Value() == 0);
+  CHECK(squares == 1);
+  CHECK(!square.IsValid());
+  a.SetValue(9);
+  CHECK(lazy.IsValid());
+
+  // In push mode with workers the auto trackers are evaluated on the draining thread.
+  global.SetWorkerCount(4);
+  std::vector<dtrack::DValue<int>> inputs;
+  for (int i = 0; i < 64; ++i) {
+    inputs.push_back(dtrack::DValue<int>(global, i));
+  }
+  std::vector<dtrack::DAutoTracker<int>> sums;
+  for (size_t i = 0; i < 32; ++i) {
+    sums.push_back(dtrack::DAutoTracker<int>(global, [&inputs, i] () {
+      return inputs[i].Value() % 2 ? inputs[i].Value() + inputs[i + 32].Value() : inputs[i].Value();
+    }));
+  }
+  // Callbacks only see changed values, a sum staying at its default 0 never calls back.
+  std::vector<int> bound(sums.size(), 0);
+  for (size_t i = 0; i < sums.size(); ++i) {
+    sums[i].Bind([&bound, i] (const int& value) { bound[i] = value; });
+  }
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  for (int round = 0; round < 3; ++round) {
+    dtrack::DTrack::Transaction transaction(global);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      inputs[i].SetValue(static_cast<int>(i) * (round + 1));
+    }
+  }
+  for (size_t i = 0; i < sums.size(); ++i) {
+    int first = static_cast<int>(i) * 3;
+    CHECK(bound[i] == (first % 2 ? first + static_cast<int>(i + 32) * 3 : first));
+  }
+  global.SetUpdateMode(dtrack::UpdateMode::Pull);
+  global.SetWorkerCount(0);
+}
+
+// Hashes every input alike.
+struct CollidingHash {
+  size_t operator()(const int&) const { return 0; }
+};
+
+TEST_CASE("Test memoizing trackers reuse the results of earlier inputs") {
+  dtrack::DTrack global;
+  dtrack::DValue<int> mode(global, 0);
+  dtrack::DValue<int> scale(global, 10);
+  int evaluations = 0;
+  dtrack::DTracker<int, int, int> scaled(global, [&evaluations] (const int& mode, const int& scale) {
+    ++evaluations;
+    return mode * scale;
+  });
+  scaled.Watch<0>(mode).Watch<1>(scale).Memoize(2);
+  CHECK(scaled.Value() == 0);
+  mode.SetValue(1);
+  CHECK(scaled.Value() == 10);
+  mode.SetValue(0);
+  CHECK(scaled.Value() == 0);
+  mode.SetValue(1);
+  CHECK(scaled.Value() == 10);
+  CHECK(evaluations == 2);
+  dtrack::MemoStatistics statistics = scaled.CacheStatistics();
+  CHECK(statistics.hits == 2);
+  CHECK(statistics.misses == 2);
+  CHECK(statistics.evictions == 0);
+
+  // Both results were hit, the hand clears their marks and evicts the first. The result hit
+  // again since is passed over, the other one is evicted.
+  mode.SetValue(2);
+  CHECK(scaled.Value() == 20);
+  mode.SetValue(1);
+  CHECK(scaled.Value() == 10);
+  mode.SetValue(3);
+  CHECK(scaled.Value() == 30);
+  mode.SetValue(1);
+  CHECK(scaled.Value() == 10);
+  CHECK(evaluations == 4);
+  mode.SetValue(2);
+  CHECK(scaled.Value() == 20);
+  CHECK(evaluations == 5);
+  statistics = scaled.CacheStatistics();
+  CHECK(statistics.hits == 4);
+  CHECK(statistics.misses == 5);
+  CHECK(statistics.evictions == 3);
+
+  // Every input is part of the key.
+  scale.SetValue(100);
+  CHECK(scaled.Value() == 200);
+  CHECK(evaluations == 6);
+  scaled.Memoize(0);
+  mode.SetValue(3);
+  CHECK(scaled.Value() == 300);
+  scale.SetValue(10);
+  CHECK(scaled.Value() == 30);
+  CHECK(evaluations == 8);
+  CHECK(scaled.CacheStatistics().hits == 0);
+
+  // The hash only picks the bucket, colliding inputs are told apart by the copies kept of them.
+  int sums = 0;
+  dtrack::DTracker<int, int, int> summed(global, [&sums] (const int& mode, const int& scale) {
+    ++sums;
+    return mode + scale;
+  });
+  summed.Watch<0>(mode).Watch<1>(scale).Memoize<CollidingHash>(2);
+  CHECK(summed.Value() == 13);
+  mode.SetValue(4);
+  CHECK(summed.Value() == 14);
+  mode.SetValue(3);
+  CHECK(summed.Value() == 13);
+  mode.SetValue(4);
+  CHECK(summed.Value() == 14);
+  CHECK(sums == 2);
+  mode.SetValue(5);
+  CHECK(summed.Value() == 15);
+  for (int round = 0; round < 10; ++round) {
+    mode.SetValue(3 + round % 3);
+    CHECK(summed.Value() == 13 + round % 3);
+  }
+  statistics = summed.CacheStatistics();
+  CHECK(statistics.hits + statistics.misses == 15);
+  CHECK(static_cast<uint64_t>(sums) == statistics.misses);
+}
+
+struct Spot : dtrack::StaticInput<double> {};
+struct Rate : dtrack::StaticInput<double> {};
+struct Strike : dtrack::StaticInput<double> {};
+
+struct Forward : dtrack::StaticNode<double, Spot, Rate> {
+  static double Calculate(const double& spot, const double& rate) {
+    ++evaluations;
+    return spot * (1 + rate);
+  }
+  static int evaluations;
+};
+
+int Forward::evaluations = 0;
+
+// Clamped, so a forward moving above the strike does not reach the payoff.
+struct Moneyness : dtrack::StaticNode<double, Forward, Strike> {
+  static double Calculate(const double& forward, const double& strike) {
+    return std::min(forward - strike, 0.0);
+  }
+};
+
+struct Payoff : dtrack::StaticNode<double, Moneyness, Forward> {
+  static double Calculate(const double& moneyness, const double& forward) {
+    ++evaluations;
+    return moneyness + forward;
+  }
+  static int evaluations;
+};
+
+int Payoff::evaluations = 0;
+
+TEST_CASE("Test static graphs update in dependency order") {
+  // Listed in any order, the graph ranks them by their inputs.
+  dtrack::StaticGraph<Payoff, Moneyness, Strike, Forward, Rate, Spot> graph;
+  CHECK(!graph.IsValid());
+  graph.Set<Spot>(100.0);
+  graph.Set<Rate>(0.5);
+  graph.Set<Strike>(200.0);
+  CHECK(graph.Value<Payoff>() == 100.0);
+  CHECK(graph.IsValid());
+  CHECK(Forward::evaluations == 1);
+  CHECK(Payoff::evaluations == 1);
+
+  graph.Set<Rate>(0.5);
+  CHECK(graph.IsValid());
+  graph.Set<Strike>(400.0);
+  CHECK(graph.ValueRef<Payoff>() == -100.0);
+  CHECK(Forward::evaluations == 1);
+  CHECK(Payoff::evaluations == 2);
+
+  graph.Set<Strike>(100.0);
+  graph.Update();
+  CHECK(graph.IsValid());
+  CHECK(graph.Value<Moneyness>() == 0.0);
+  CHECK(graph.Value<Payoff>() == 150.0);
+  CHECK(Payoff::evaluations == 3);
+  graph.Set<Strike>(120.0);
+  CHECK(graph.Value<Payoff>() == 150.0);
+  CHECK(Payoff::evaluations == 3);
+  graph.Set<Spot>(200.0);
+  CHECK(graph.Value<Forward>() == 300.0);
+  CHECK(graph.Value<Payoff>() == 300.0);
+  CHECK(Forward::evaluations == 2);
+  CHECK(Payoff::evaluations == 4);
+}
+
+#if defined(DTRACK_USE_COROUTINES)
+// Suspends the coroutine and resumes it through the queue again.
+struct Requeue {
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> handle) { queue->Executor()([handle] () { handle.resume(); }); }
+  void await_resume() {}
+
+  dtrack::AsyncQueue* queue;
+};
+
+TEST_CASE("Test async trackers deliver the latest launch only") {
+  dtrack::DTrack global;
+  dtrack::AsyncQueue queue;
+  dtrack::DValue<int> input(global, 1);
+  int started = 0;
+  int cancelled = 0;
+  dtrack::AsyncDTracker<int, int> doubled(global, queue.Executor(), [&] (dtrack::CancelToken token, int value) -> dtrack::Task<int> {
+    ++started;
+    co_await Requeue{ &queue };
+    if (token.Cancelled()) {
+      ++cancelled;
+      co_return -1;
+    }
+    co_return value * 2;
+  });
+  doubled.Watch<0>(input);
+  std::vector<int> delivered;
+  doubled.Bind([&delivered] (const int& value) { delivered.push_back(value); });
+  dtrack::DTracker<int, int> plus_one(global, [] (const int& value) { return value + 1; });
+  plus_one.Watch<0>(doubled.Result());
+  CHECK(doubled.Pending());
+  CHECK(doubled.Value() == 0);
+
+  global.Apply();
+  CHECK(queue.RunPending() == 1);
+  CHECK(doubled.Pending());
+  CHECK(queue.RunPending() == 1);
+  CHECK(doubled.Ready());
+  CHECK(doubled.Value() == 2);
+  CHECK(plus_one.Value() == 3);
+  CHECK(delivered == std::vector<int>{2});
+
+  // A burst of writes launches once per write, only the last launch starts.
+  global.SetUpdateMode(dtrack::UpdateMode::Push);
+  for (int i = 2; i <= 10; ++i) {
+    input.SetValue(i);
+  }
+  CHECK(doubled.Pending());
+  CHECK(queue.RunPending() == 9);
+  CHECK(started == 2);
+  // A write while the calculation is suspended supersedes it, it sees the cancellation.
+  input.SetValue(11);
+  while (queue.RunPending()) {
+
+  }
+  CHECK(started == 3);
+  CHECK(cancelled == 1);
+  CHECK(doubled.Ready());
+  CHECK(doubled.Value() == 22);
+  CHECK(plus_one.Value() == 23);
+  CHECK(delivered == std::vector<int>{2, 22});
+  global.SetUpdateMode(dtrack::UpdateMode::Pull);
+}
+
+TEST_CASE("Test async tracker callbacks may bind, launch and destroy their tracker") {
+  dtrack::DTrack global;
+  dtrack::AsyncQueue queue;
+  dtrack::DValue<int> input(global, 1);
+  std::unique_ptr<dtrack::AsyncDTracker<int, int>> negated(
+    new dtrack::AsyncDTracker<int, int>(global, queue.Executor(), [] (dtrack::CancelToken, int value) -> dtrack::Task<int> {
+      co_return -value;
+    })
+  );
+  negated->Watch<0>(input);
+  std::vector<int> delivered;
+  negated->Bind([&] (const int& value) {
+    delivered.push_back(value);
+    input.SetValue(2);
+    negated->Update();
+    negated->Bind([&] (const int& value) {
+      delivered.push_back(value * 10);
+      negated.reset();
+    });
+  });
+  negated->Update();
+  while (queue.RunPending()) {
+
+  }
+  CHECK(delivered == std::vector<int>{-1, -20});
+  CHECK(!negated);
+}
+
+TEST_CASE("Test async trackers of concurrent graphs finish on other threads") {
+  dtrack::DTrack global(dtrack::ThreadMode::Concurrent);
+  std::mutex threads_mutex;
+  std::vector<std::thread> threads;
+  dtrack::AsyncExecutor executor = [&threads_mutex, &threads] (std::function<void()> work) {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    threads.emplace_back(std::move(work));
+  };
+  dtrack::DValue<int> input(global, 1);
+  std::atomic<int> delivered(0);
+  // Holds the last launch back, the coroutine outlives the captures of its lambda.
+  static std::atomic<bool> release(false);
+  {
+    dtrack::AsyncDTracker<int, int> squared(global, executor, [] (dtrack::CancelToken, int value) -> dtrack::Task<int> {
+      while (value == 8 && !release.load()) {
+        std::this_thread::yield();
+      }
+      co_return value * value;
+    });
+    squared.Watch<0>(input).Bind([&delivered] (const int& value) { delivered = value; });
+    input.SetValue(7);
+    squared.Update();
+    // Ready once the value is there.
+    while (!squared.Ready()) {
+      std::this_thread::yield();
+    }
+    CHECK(squared.Value() == 49);
+    {
+      std::lock_guard<std::mutex> lock(threads_mutex);
+      for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+      }
+      threads.clear();
+    }
+    CHECK(delivered == 49);
+    CHECK(squared.Ready());
+    CHECK(squared.Value() == 49);
+    input.SetValue(8);
+    squared.Update();
+  }
+  // The tracker is gone before its last launch finishes, which delivers nothing.
+  release = true;
+  std::lock_guard<std::mutex> lock(threads_mutex);
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+  }
+  CHECK(delivered == 49);
+}
+#endif
+
+struct CopyCounted {
+  CopyCounted() : items() {}
+  explicit CopyCounted(size_t count) : items(count, 1) {}
+  CopyCounted(const CopyCounted& another) : items(another.items) { ++copies; }
+  CopyCounted(CopyCounted&& another) = default;
+  CopyCounted& operator=(const CopyCounted& another) { items = another.items; ++copies; return *this; }
+  CopyCounted& operator=(CopyCounted&& another) = default;
+  bool operator!=(const CopyCounted& another) const { return items != another.items; }
+
+  std::vector<int> items;
+  static int copies;
+};
+
+int CopyCounted::copies = 0;
+
+TEST_CASE("Test values are written without copies") {
+  dtrack::DTrack global;
+  CopyCounted::copies = 0;
+  dtrack::DValue<CopyCounted> source(global, CopyCounted(3));
+  int evaluations = 0;
+  dtrack::DTracker<size_t, CopyCounted> size(global, [&evaluations] (const CopyCounted& input) {
+    ++evaluations;
+    return input.items.size();
+  });
+  size.Watch<0>(source);
+  CHECK(size.Value() == 3);
+  source.SetValue(CopyCounted(4));
+  CHECK(size.Value() == 4);
+  source.Emplace(5);
+  CHECK(size.Value() == 5);
+  source.Modify([] (CopyCounted& value) { value.items.push_back(2); return true; });
+  CHECK(size.Value() == 6);
+  CHECK(source.ValueRef().items.back() == 2);
+  source.Modify([] (CopyCounted&) { return false; });
+  CHECK(size.Value() == 6);
+  CHECK(evaluations == 4);
+  // Trackers are read without copies too, through a const handle as well.
+  dtrack::DTracker<CopyCounted, CopyCounted> reversed(global, [] (const CopyCounted& input) {
+    CopyCounted output;
+    output.items.assign(input.items.rbegin(), input.items.rend());
+    return output;
+  });
+  reversed.Watch<0>(source);
+  const dtrack::DTracker<CopyCounted, CopyCounted>& read_only = reversed;
+  CHECK(read_only.ValueRef().items.front() == 2);
+  CHECK(&read_only.ValueRef() == &reversed.ValueRef());
+  CHECK(CopyCounted::copies == 0);
+}
+
+struct Versioned {
+  int Version() const { return version; }
+
+  int version;
+  int payload;
+};
+
+struct NotComparable {
+  int payload;
+};
+
+struct NotComparableHash {
+  size_t operator()(const NotComparable& value) const { return std::hash<int>()(value.payload); }
+};
+
+namespace dtrack {
+  template<>
+  struct ChangePolicy<NotComparable> {
+    typedef HashCompare<NotComparableHash> type;
+  };
+}
+
+TEST_CASE("Test change policies decide when watchers are invalidated") {
+  dtrack::DTrack global;
+  int evaluations = 0;
+  dtrack::DValue<int, dtrack::AlwaysInvalidate> always(global, 1);
+  dtrack::DTracker<int, int> from_always(global, [&evaluations] (const int& input) { ++evaluations; return input; });
+  from_always.Watch<0>(always);
+  CHECK(from_always.Value() == 1);
+  always.SetValue(1);
+  CHECK(from_always.Value() == 1);
+  CHECK(evaluations == 2);
+
+  dtrack::DValue<Versioned, dtrack::VersionCompare> versioned(global, Versioned{ 1, 10 });
+  dtrack::DTracker<NotComparable, Versioned> wrapped(global, [] (const Versioned& input) {
+    return NotComparable{ input.payload };
+  });
+  wrapped.Watch<0>(versioned);
+  CHECK(wrapped.Value().payload == 10);
+  versioned.SetValue(Versioned{ 1, 20 });
+  CHECK(versioned.ValueRef().payload == 10);
+  versioned.SetValue(Versioned{ 2, 20 });
+  CHECK(wrapped.Value().payload == 20);
+
+  dtrack::DValue<NotComparable> hashed(global, NotComparable{ 5 });
+  dtrack::DTracker<int, NotComparable> unwrapped(global, [&evaluations] (const NotComparable& input) {
+    ++evaluations;
+    return input.payload;
+  });
+  unwrapped.Watch<0>(hashed);
+  CHECK(unwrapped.Value() == 5);
+  hashed.SetValue(NotComparable{ 5 });
+  CHECK(unwrapped.Value() == 5);
+  CHECK(evaluations == 3);
+  hashed.SetValue(NotComparable{ 6 });
+  CHECK(unwrapped.Value() == 6);
+  CHECK(evaluations == 4);
+}
+
+TEST_CASE("Test trackers deduce their types from the calculator") {
+  dtrack::DTrack global;
+  dtrack::DValue<int> source(global, 1);
+  int calls = 0;
+  auto counted = dtrack::MakeTracker(global, [calls] (const int& input) mutable { return input + ++calls; });
+  counted.Watch<0>(source);
+  CHECK(counted.Value() == 2);
+  source.SetValue(5);
+  CHECK(counted.Value() == 7);
+#if defined(__cpp_deduction_guides)
+  dtrack::DTracker next(global, &Calculator);
+  next.Watch<0>(counted);
+  CHECK(next.Value() == 8);
+#endif
+}
+
+TEST_CASE("Test position allocation reuses freed slots") {
+  const size_t bits = sizeof(uintptr_t) * CHAR_BIT;
+  dtrack::detail::PositionAllocator allocator;
+  std::vector<std::tuple<size_t, uintptr_t>> positions;
+  for (size_t i = 0; i < bits * bits + 3; ++i) {
+    positions.push_back(allocator.Allocate());
+    CHECK(std::get<0>(positions.back()) == i / bits);
+    CHECK(std::get<1>(positions.back()) == (static_cast<uintptr_t>(1) << (i % bits)));
+  }
+  allocator.Free(positions[bits * 7 + 5]);
+  allocator.Free(positions[bits * 2 + 9]);
+  CHECK(allocator.Allocate() == positions[bits * 2 + 9]);
+  CHECK(allocator.Allocate() == positions[bits * 7 + 5]);
+  CHECK(std::get<0>(allocator.Allocate()) == bits);
+  for (size_t i = 0; i < bits; ++i) {
+    allocator.Free(positions[bits * 3 + i]);
+  }
+  CHECK(allocator.Occupied(3) == 0);
+  CHECK(allocator.Allocate() == std::make_tuple(static_cast<size_t>(3), static_cast<uintptr_t>(1)));
+}
+
+TEST_CASE("Test node pools reuse freed blocks of the same size") {
+  dtrack::detail::NodePool pool;
+  void* first = pool.Allocate(40);
+  void* second = pool.Allocate(40);
+  void* other_size = pool.Allocate(100);
+  CHECK(first != second);
+  CHECK(reinterpret_cast<uintptr_t>(other_size) % alignof(std::max_align_t) == 0);
+  pool.Free(first, 40);
+  void* reused = pool.Allocate(100);
+  CHECK(reused != first);
+  pool.Free(reused, 100);
+  CHECK(pool.Allocate(40) == first);
+  pool.Free(first, 40);
+  void* large = pool.Allocate(1 << 20);
+  pool.Free(large, 1 << 20);
+  pool.Free(second, 40);
+  pool.Free(other_size, 100);
+}
+
+TEST_CASE("Test position sets keep words sorted past the inline capacity") {
+  dtrack::detail::PositionSet<2> positions;
+  size_t words[] = { 9, 3, 7, 1, 5 };
+  for (size_t word : words) {
+    positions.Insert(std::make_tuple(word, static_cast<uintptr_t>(1)));
+  }
+  positions.Insert(std::make_tuple(static_cast<size_t>(7), static_cast<uintptr_t>(4)));
+  REQUIRE(positions.size() == 5);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    CHECK(std::get<0>(positions.begin()[i]) == i * 2 + 1);
+  }
+  CHECK(std::get<1>(positions.begin()[3]) == 5);
+  positions.Erase(std::make_tuple(static_cast<size_t>(7), static_cast<uintptr_t>(1)));
+  CHECK(std::get<1>(positions.begin()[3]) == 4);
+  positions.Erase(std::make_tuple(static_cast<size_t>(7), static_cast<uintptr_t>(4)));
+  positions.Erase(std::make_tuple(static_cast<size_t>(1), static_cast<uintptr_t>(1)));
+  REQUIRE(positions.size() == 3);
+  CHECK(std::get<0>(positions.begin()[0]) == 3);
+  CHECK(std::get<0>(positions.begin()[1]) == 5);
+  CHECK(std::get<0>(positions.begin()[2]) == 9);
+}
+
+TEST_CASE("Test bit operations") {
+  // The intrinsics of msvc can not be evaluated at compile time.
+#if !defined(BITOPS_USE_MSVC)
+  static_assert(bitops::CountTrailingZeros(static_cast<uint64_t>(0x80)) == 7, "evaluated at compile time");
+  static_assert(bitops::FindNthSet(static_cast<uint32_t>(0x16), 2) == 4, "evaluated at compile time");
+#endif
+  CHECK(bitops::CountTrailingZeros(static_cast<uint64_t>(0x80)) == 7);
+  CHECK(bitops::FindNthSet(static_cast<uint32_t>(0x16), 2) == 4);
+  CHECK(bitops::CountTrailingZeros(static_cast<uint64_t>(0)) == 64);
+  CHECK(bitops::CountTrailingZeros(static_cast<uint64_t>(1) << 63) == 63);
+  CHECK(bitops::CountTrailingZeros(static_cast<uint32_t>(0x100)) == 8);
+  CHECK(bitops::CountTrailingZeros(static_cast<uint8_t>(0)) == 8);
+  CHECK(bitops::CountLeadingZeros(static_cast<uint64_t>(0)) == 64);
+  CHECK(bitops::CountLeadingZeros(static_cast<uint64_t>(1)) == 63);
+  CHECK(bitops::CountLeadingZeros(static_cast<uint16_t>(0x00F0)) == 8);
+  CHECK(bitops::CountLeadingZeros(static_cast<uint32_t>(0x80000000)) == 0);
+  CHECK(bitops::PopCount(static_cast<uint64_t>(0)) == 0);
+  CHECK(bitops::PopCount(std::numeric_limits<uint64_t>::max()) == 64);
+  CHECK(bitops::PopCount(static_cast<uint32_t>(0xF0F0)) == 8);
+  CHECK(bitops::FindNthSet(static_cast<uint64_t>(0xA5), 0) == 0);
+  CHECK(bitops::FindNthSet(static_cast<uint64_t>(0xA5), 3) == 7);
+  CHECK(bitops::FindNthSet(static_cast<uint64_t>(0xA5), 4) == 64);
+}
+
+TEST_CASE("Test scanning skips zero words") {
+  std::vector<uintptr_t> words(1000, 0);
+  const size_t non_zero[] = { 0, 7, 8, 31, 32, 500, 998, 999 };
+  for (size_t word : non_zero) {
+    words[word] = static_cast<uintptr_t>(word + 1);
+  }
+  std::vector<size_t> visited;
+  dtrack::detail::ForEachNonZeroWord(
+    words.data(),
+    words.size(),
+    [&visited, &words] (size_t word, uintptr_t bits) {
+      CHECK(words[word] == bits);
+      visited.push_back(word);
+    }
+  );
+  CHECK(visited == std::vector<size_t>(std::begin(non_zero), std::end(non_zero)));
+  CHECK(dtrack::detail::FindNonZeroWord(words.data(), 33, 500) == 500);
+  CHECK(dtrack::detail::FindNonZeroWord(words.data(), 501, 998) == 998);
+}
+
 int main(int argc, char* argv[]) {
   printf("Running main() from %s\n", __FILE__);
+#ifdef MANIPULATE_BITMAP_DEBUG
   int flag = _CrtSetDbgFlag(_CRTDBG_REPORT_FLAG);
   flag |= _CRTDBG_LEAK_CHECK_DF;
   flag |= _CRTDBG_ALLOC_MEM_DF;
@@ -55,8 +1628,11 @@ int main(int argc, char* argv[]) {
   _CrtSetReportMode(_CRT_WARN, _CRTDBG_MODE_FILE | _CRTDBG_MODE_DEBUG);
   _CrtSetReportFile(_CRT_WARN, _CRTDBG_FILE_STDERR);
   _CrtSetBreakAlloc(-1);
+#endif // MANIPULATE_BITMAP_DEBUG
   int result = Catch::Session().run(argc, argv);
+#ifdef MANIPULATE_BITMAP_DEBUG
   _CrtDumpMemoryLeaks();
+#endif // MANIPULATE_BITMAP_DEBUG
   std::getchar();
   return result;
 }